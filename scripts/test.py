@@ -1,7 +1,11 @@
 import os
+import select
+import shutil
+import signal
 import subprocess
 import sys
-from tempfile import TemporaryFile
+import threading
+from tempfile import TemporaryFile, mkdtemp
 
 ROOT_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), os.pardir)
 TEST_ROOT_DIR = os.path.join(ROOT_DIR, "test")
@@ -10,29 +14,83 @@ TEST_DIR_PREFIX = "test-"
 INFILE = "in"
 OUTFILE = "out"
 PARAMFILE = "params"
+CRASHFILE = "crash"
+CRASH_TIMEOUT = 60
 SEPARATOR = "-" * 80
 
 
-def run_test(test_dir):
-    cwd = os.getcwd()
-    os.chdir(test_dir)
+def test_steps():
+    """
+    A test runs the tree once on in, out and params, or once per step
+    on in-1, out-1, params-1, in-2 and so on, each step seeing the
+    files the steps before it left behind. A step with a crash-N file
+    is killed once it has printed its output, instead of being left to
+    exit.
+    """
+    if os.path.exists(INFILE):
+        return [""]
+
+    steps = []
+
+    while os.path.exists("{}-{}".format(INFILE, len(steps) + 1)):
+        steps.append("-{}".format(len(steps) + 1))
+
+    return steps
+
+
+def run_crashing(args, infile, expected_size):
+    """
+    Feed the input without closing stdin, then kill the tree as soon
+    as it has printed the expected amount of output
+    """
+    process = subprocess.Popen(args, stdin=subprocess.PIPE, stdout=subprocess.PIPE)
+    obtained = b""
+
+    def feed():
+        try:
+            process.stdin.write(infile.read().encode())
+            process.stdin.flush()
+        except IOError:
+            pass
+
+    feeder = threading.Thread(target=feed)
+    feeder.start()
+
+    while len(obtained) < expected_size:
+        if not select.select([process.stdout], [], [], CRASH_TIMEOUT)[0]:
+            break
+
+        data = os.read(process.stdout.fileno(), expected_size - len(obtained))
+        if not data:
+            break
+
+        obtained += data
 
-    with open(INFILE, 'r') as infile, open(OUTFILE, 'r') as outfile, TemporaryFile('r') as dump:
+    process.send_signal(signal.SIGKILL)
+    process.wait()
+    feeder.join()
+
+    return obtained.decode()
+
+
+def run_step(step):
+    with open(INFILE + step, 'r') as infile, open(OUTFILE + step, 'r') as outfile, TemporaryFile('r') as dump:
         try:
-            params = open(PARAMFILE, 'r').read().rstrip().split(' ')
+            params = open(PARAMFILE + step, 'r').read().rstrip().split(' ')
         except Exception as e:
             print(e)
             params = []
         print([LSM_TREE_EXECUTABLE] + params)
-        subprocess.call([LSM_TREE_EXECUTABLE] + params, stdin=infile, stdout=dump)
-        dump.seek(0)
-
-        expected, obtained = outfile.read(), dump.read()
+        expected = outfile.read()
 
-        if expected == obtained:
-            print("* Test {} SUCCEEDED".format(test_dir))
+        if os.path.exists(CRASHFILE + step):
+            obtained = run_crashing([LSM_TREE_EXECUTABLE] + params, infile, len(expected.encode()))
         else:
-            print("x Test {} FAILED".format(test_dir))
+            subprocess.call([LSM_TREE_EXECUTABLE] + params, stdin=infile, stdout=dump)
+            dump.seek(0)
+            obtained = dump.read()
+
+        if expected != obtained:
             print(SEPARATOR)
 
             print("Expected:")
@@ -45,7 +103,24 @@ def run_test(test_dir):
             print(obtained)
             print(SEPARATOR)
 
+        return expected == obtained
+
+
+def run_test(test_dir):
+    cwd = os.getcwd()
+
+    # Tests may leave data directories behind, so run them in a copy
+    work_dir = mkdtemp()
+    shutil.copytree(test_dir, os.path.join(work_dir, "test"))
+    os.chdir(os.path.join(work_dir, "test"))
+
+    if all([run_step(step) for step in test_steps()]):
+        print("* Test {} SUCCEEDED".format(test_dir))
+    else:
+        print("x Test {} FAILED".format(test_dir))
+
     os.chdir(cwd)
+    shutil.rmtree(work_dir)
 
 
 if __name__ == "__main__":
@@ -0,0 +1,65 @@
+#include <cassert>
+#include <cstdlib>
+
+#include "arena.h"
+
+using namespace std;
+
+Arena::~Arena(void) {
+    for (auto block : blocks) {
+        free(block);
+    }
+}
+
+char * Arena::allocate(size_t bytes) {
+    char *result;
+
+    // Keep every allocation pointer-aligned
+    bytes = (bytes + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+
+    lock.lock();
+
+    if (bytes > alloc_remaining) {
+        result = allocate_fallback(bytes);
+    } else {
+        result = alloc_ptr;
+        alloc_ptr += bytes;
+        alloc_remaining -= bytes;
+    }
+
+    lock.unlock();
+
+    return result;
+}
+
+char * Arena::allocate_fallback(size_t bytes) {
+    char *block;
+
+    assert(bytes <= ARENA_BLOCK_SIZE);
+
+    /*
+     * Move on to the next retained block if there is one,
+     * otherwise grab a fresh block from the system.
+     */
+
+    if (current_block < blocks.size()) {
+        block = blocks[current_block];
+    } else {
+        block = (char *)malloc(ARENA_BLOCK_SIZE);
+        assert(block != nullptr);
+        blocks.push_back(block);
+    }
+
+    current_block++;
+
+    alloc_ptr = block + bytes;
+    alloc_remaining = ARENA_BLOCK_SIZE - bytes;
+
+    return block;
+}
+
+void Arena::reset(void) {
+    current_block = 0;
+    alloc_ptr = nullptr;
+    alloc_remaining = 0;
+}
@@ -0,0 +1,38 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <vector>
+
+#include "spin_lock.h"
+
+#define ARENA_BLOCK_SIZE (1 << 20)
+
+using namespace std;
+
+/*
+ * Bump allocator backing the buffer's skip list. Memory is handed
+ * out from large blocks and is only ever released all at once, so a
+ * put never touches the system allocator after the first few blocks
+ * have been obtained. Blocks are kept across reset() calls and reused
+ * for the next generation of buffer entries. Concurrent puts allocate
+ * under a spin lock, which is only held to bump the pointer.
+ */
+class Arena {
+    SpinLock lock;
+    vector<char *> blocks;
+    size_t current_block;
+    char *alloc_ptr;
+    size_t alloc_remaining;
+    char * allocate_fallback(size_t);
+public:
+    Arena(void) : current_block(0), alloc_ptr(nullptr), alloc_remaining(0) {}
+    ~Arena(void);
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+    char * allocate(size_t);
+    void reset(void);
+    size_t memory_usage(void) const {return blocks.size() * ARENA_BLOCK_SIZE;}
+};
+
+#endif
@@ -0,0 +1,88 @@
+#include <cstring>
+#include <unistd.h>
+
+#include "block_cache.h"
+
+using namespace std;
+
+// File ids take the high bits of the key, page indices the low ones
+static uint64_t page_key(uint64_t file_id, long page_index) {
+    return (file_id << 32) | (uint64_t)page_index;
+}
+
+BlockCache::BlockCache(size_t budget) : num_hits(0), num_misses(0) {
+    page_size = getpagesize();
+    shard_slots = budget / getpagesize() / BLOCK_CACHE_NUM_SHARDS;
+
+    for (auto& s : shards) {
+        s.slots.reserve(shard_slots);
+        s.hand = 0;
+    }
+}
+
+/*
+ * Return the page if it is cached, pinned rather than copied
+ */
+pinned_page_t BlockCache::get(uint64_t file_id, long page_index) {
+    uint64_t key;
+    unordered_map<uint64_t, long>::iterator it;
+
+    key = page_key(file_id, page_index);
+    shard& s = shard_for(key);
+
+    {
+        lock_guard<mutex> guard(s.lock);
+
+        if ((it = s.index.find(key)) != s.index.end()) {
+            s.slots[it->second].referenced = true;
+            num_hits++;
+            return s.slots[it->second].page;
+        }
+    }
+
+    num_misses++;
+    return nullptr;
+}
+
+/*
+ * Add a copy of the page, evicting the first unreferenced page the
+ * hand comes across once the shard is full. Scans insert their pages
+ * unreferenced.
+ */
+void BlockCache::insert(uint64_t file_id, long page_index, const void *page, bool scan) {
+    uint64_t key;
+    long victim;
+
+    if (shard_slots == 0) return;
+
+    key = page_key(file_id, page_index);
+    shard& s = shard_for(key);
+
+    lock_guard<mutex> guard(s.lock);
+
+    if (s.index.count(key) > 0) return;
+
+    if (s.slots.size() < shard_slots) {
+        victim = s.slots.size();
+        s.slots.push_back({key, false, make_shared<vector<char>>(page_size)});
+    } else {
+        while (s.slots[s.hand].referenced) {
+            s.slots[s.hand].referenced = false;
+            s.hand = (s.hand + 1) % shard_slots;
+        }
+
+        victim = s.hand;
+        s.hand = (s.hand + 1) % shard_slots;
+        s.index.erase(s.slots[victim].key);
+
+        // Readers may still hold the evicted page
+        if (s.slots[victim].page.use_count() > 1) {
+            s.slots[victim].page = make_shared<vector<char>>(page_size);
+        }
+    }
+
+    s.slots[victim].key = key;
+    s.slots[victim].referenced = !scan;
+    s.index[key] = victim;
+    memcpy(s.slots[victim].page->data(), page, page_size);
+}
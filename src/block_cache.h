@@ -0,0 +1,56 @@
+#ifndef BLOCK_CACHE_H
+#define BLOCK_CACHE_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "types.h"
+
+#define BLOCK_CACHE_NUM_SHARDS 16
+#define BLOCK_CACHE_SCAN_PAGES 4
+
+using namespace std;
+
+// A cached page, which stays valid while it is held even if evicted
+typedef shared_ptr<const vector<char>> pinned_page_t;
+
+/*
+ * Cache of run file pages shared by all runs, with a fixed byte
+ * budget split across shards that are locked independently. Pages
+ * are keyed by file id and page index and replaced with CLOCK. Pages
+ * read by a lookup start out referenced and survive one sweep of the
+ * hand, while pages read by a scan do not, so a long scan only ever
+ * evicts pages no lookup has used since the last sweep.
+ */
+class BlockCache {
+    struct slot {
+        uint64_t key;
+        bool referenced;
+        shared_ptr<vector<char>> page;
+    };
+    struct shard {
+        mutex lock;
+        unordered_map<uint64_t, long> index;
+        vector<slot> slots;
+        long hand;
+    };
+    long page_size;
+    long shard_slots;
+    shard shards[BLOCK_CACHE_NUM_SHARDS];
+    atomic<long> num_hits, num_misses;
+    shard& shard_for(uint64_t key) {
+        return shards[((key * 0x9e3779b97f4a7c15ULL) >> 32) % BLOCK_CACHE_NUM_SHARDS];
+    }
+public:
+    BlockCache(size_t);
+    pinned_page_t get(uint64_t, long);
+    void insert(uint64_t, long, const void *, bool);
+    long hits(void) const {return num_hits;}
+    long misses(void) const {return num_misses;}
+};
+
+#endif
@@ -1,59 +1,179 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BLOOM_FILTER_X86
+#endif
+
 #include "bloom_filter.h"
+#include "sys.h"
+
+// One odd multiplier per bit set in a block
+static const uint32_t salts[BLOOM_MAX_HASHES] = {
+    0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+    0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U
+};
+
+BloomFilter::BloomFilter(long length, int num_hashes) : blocks(nullptr), sized(true) {
+    reset(length, num_hashes);
+}
+
+BloomFilter::BloomFilter(float bits_per_entry) : blocks(nullptr), num_blocks(0),
+                                                 num_hashes(0),
+                                                 bits_per_entry(bits_per_entry),
+                                                 sized(false) {}
+
+BloomFilter::~BloomFilter(void) {
+    free(blocks);
+}
 
 /*
- * Hash functions taken from https://gist.github.com/badboy/6267743
- * and modified for the C++ environment.
+ * Restore a filter saved with save
  */
-// 简单的一个bloom_filter
-uint64_t BloomFilter::hash_1(KEY_t k) const {
-    uint64_t key;
+BloomFilter::BloomFilter(const char *data, size_t length) : blocks(nullptr), sized(true) {
+    int64_t header[2];
+
+    if (length < sizeof(header)) die("Corrupt bloom filter.");
 
-    key = k;
-    key = ~key + (key<<15);
-    key = key ^ (key>>12);
-    key = key + (key<<2);
-    key = key ^ (key>>4);
-    key = key * 2057;
-    key = key ^ (key>>16);
+    memcpy(header, data, sizeof(header));
+    reset(header[0] * BLOOM_BLOCK_BITS, header[1]);
 
-    return key % table.size();
+    if (length != sizeof(header) + data_size()) die("Corrupt bloom filter.");
+
+    memcpy(blocks, data + sizeof(header), data_size());
 }
 
-uint64_t BloomFilter::hash_2(KEY_t k) const {
-    uint64_t key;
+/*
+ * Make the filter an empty one of at least the given number of bits
+ */
+void BloomFilter::reset(long length, int hashes) {
+    free(blocks);
+
+    num_blocks = std::max((length + BLOOM_BLOCK_BITS - 1) / (long)BLOOM_BLOCK_BITS, (long)1);
+    num_hashes = std::min(std::max(hashes, 0), BLOOM_MAX_HASHES);
+
+    if (posix_memalign((void **)&blocks, BLOOM_BLOCK_BYTES, data_size()) != 0) {
+        die("Could not allocate bloom filter.");
+    }
 
-    key = k;
-    key = (key+0x7ed55d16) + (key<<12);
-    key = (key^0xc761c23c) ^ (key>>19);
-    key = (key+0x165667b1) + (key<<5);
-    key = (key+0xd3a2646c) ^ (key<<9);
-    key = (key+0xfd7046c5) + (key<<3);
-    key = (key^0xb55a4f09) ^ (key>>16);
+    memset(blocks, 0, data_size());
+}
 
-    return key % table.size();
+// Number of bits set per key that minimizes false positives
+int BloomFilter::optimal_hashes(float bits_per_entry) {
+    return (int)lround(bits_per_entry * log(2));
 }
 
-uint64_t BloomFilter::hash_3(KEY_t k) const {
-    uint64_t key;
+/*
+ * The high half of the hash picks the block, the low half the bits
+ * within it. The top bit of each salted product picks the upper or lower half
+ * of the block, and the next five the bit within a word of that half,
+ * so bit i always lands in word i or word i + 8.
+ */
+void BloomFilter::set_bits(uint64_t hash) {
+    uint32_t *block, product;
+    int i;
 
-    key = k;
-    key = (key^61) ^ (key>>16);
-    key = key + (key<<3);
-    key = key ^ (key>>4);
-    key = key * 0x27d4eb2d;
-    key = key ^ (key>>15);
+    block = blocks + ((hash >> 32) * num_blocks >> 32) * BLOOM_BLOCK_WORDS;
 
-    return key % table.size();
+    for (i = 0; i < num_hashes; i++) {
+        product = (uint32_t)hash * salts[i];
+        block[i + (product >> 31) * 8] |= (uint32_t)1 << ((product << 1) >> 27);
+    }
 }
 
-void BloomFilter::set(KEY_t key) {
-    table.set(hash_1(key));
-    table.set(hash_2(key));
-    table.set(hash_3(key));
+void BloomFilter::set(uint64_t hash) {
+    if (sized) {
+        set_bits(hash);
+    } else {
+        hashes.push_back(hash);
+    }
 }
 
-bool BloomFilter::is_set(KEY_t key) const {
-    return (table.test(hash_1(key))
-         && table.test(hash_2(key))
-         && table.test(hash_3(key)));
+/*
+ * Size the filter for the keys collected, and set their bits
+ */
+void BloomFilter::build(void) {
+    if (sized) return;
+
+    reset(hashes.size() * bits_per_entry, optimal_hashes(bits_per_entry));
+    sized = true;
+
+    for (auto hash : hashes) set_bits(hash);
+
+    hashes.clear();
+    hashes.shrink_to_fit();
+}
+
+static bool block_test_scalar(const uint32_t *block, uint64_t hash, int num_hashes) {
+    uint32_t product;
+    int i;
+
+    for (i = 0; i < num_hashes; i++) {
+        product = (uint32_t)hash * salts[i];
+
+        if (!(block[i + (product >> 31) * 8] & ((uint32_t)1 << ((product << 1) >> 27)))) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+#ifdef BLOOM_FILTER_X86
+/*
+ * Derive all eight bits at once, and test each half of the block
+ * with one instruction
+ */
+__attribute__((target("avx2")))
+static bool block_test_avx2(const uint32_t *block, uint64_t hash, int num_hashes) {
+    __m256i products, upper, bits, used, lower_mask, upper_mask;
+
+    products = _mm256_mullo_epi32(_mm256_set1_epi32((uint32_t)hash),
+                                  _mm256_loadu_si256((const __m256i *)salts));
+    upper = _mm256_srai_epi32(products, 31);
+    bits = _mm256_sllv_epi32(_mm256_set1_epi32(1),
+                             _mm256_srli_epi32(_mm256_slli_epi32(products, 1), 27));
+    // Lanes past the number of hashes test no bits
+    used = _mm256_cmpgt_epi32(_mm256_set1_epi32(num_hashes),
+                              _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    bits = _mm256_and_si256(bits, used);
+    lower_mask = _mm256_andnot_si256(upper, bits);
+    upper_mask = _mm256_and_si256(upper, bits);
+
+    return _mm256_testc_si256(_mm256_load_si256((const __m256i *)block), lower_mask)
+        && _mm256_testc_si256(_mm256_load_si256((const __m256i *)(block + 8)), upper_mask);
+}
+#endif
+
+typedef bool (*block_test_kernel)(const uint32_t *, uint64_t, int);
+
+static block_test_kernel select_kernel(void) {
+#ifdef BLOOM_FILTER_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return block_test_avx2;
+#endif
+    return block_test_scalar;
+}
+
+// Picked once, when the program starts
+static const block_test_kernel block_test = select_kernel();
+
+bool BloomFilter::is_set(uint64_t hash) const {
+    return block_test(blocks + ((hash >> 32) * num_blocks >> 32) * BLOOM_BLOCK_WORDS,
+                      hash, num_hashes);
+}
+
+void BloomFilter::save(string& out) const {
+    int64_t header[3];
+
+    header[0] = FILTER_BLOOM;
+    header[1] = num_blocks;
+    header[2] = num_hashes;
+
+    out.append((const char *)header, sizeof(header));
+    out.append((const char *)blocks, data_size());
 }
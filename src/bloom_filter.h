@@ -1,15 +1,51 @@
-#include <boost/dynamic_bitset.hpp>
-#include <bitset>
+#ifndef BLOOM_FILTER_H
+#define BLOOM_FILTER_H
 
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "filter.h"
 #include "types.h"
+
+#define BLOOM_BLOCK_BYTES 64
+#define BLOOM_BLOCK_WORDS (BLOOM_BLOCK_BYTES / sizeof(uint32_t))
+#define BLOOM_BLOCK_BITS (BLOOM_BLOCK_BYTES * 8)
+#define BLOOM_MAX_HASHES 8
+
 // BloomFilter
-class BloomFilter {
-   boost::dynamic_bitset<> table;
-   uint64_t hash_1(KEY_t) const;
-   uint64_t hash_2(KEY_t) const;
-   uint64_t hash_3(KEY_t) const;
+/*
+ * Blocked Bloom filter: the filter is an array of cache-line sized
+ * blocks, and all the bits of a key are set in the one block its hash
+ * picks, so a probe touches a single cache line. Within the block,
+ * up to eight bits are derived from the same hash by multiplying it
+ * with one odd constant per bit, which AVX2 does in one go. A filter
+ * setting no bits lets every key through. A filter created with only
+ * its bits per entry collects the hashes of its keys, and is sized
+ * for the keys it got when it is built.
+ */
+class BloomFilter : public Filter {
+    uint32_t *blocks;
+    long num_blocks;
+    int num_hashes;
+    vector<uint64_t> hashes;
+    float bits_per_entry;
+    bool sized;
+    void reset(long, int);
+    void set_bits(uint64_t);
+    size_t data_size(void) const {return num_blocks * BLOOM_BLOCK_BYTES;}
 public:
-    BloomFilter(long length) : table(length) {}
-    void set(KEY_t);
-    bool is_set(KEY_t) const;
+    BloomFilter(long, int);
+    BloomFilter(float);
+    BloomFilter(const char *, size_t);
+    ~BloomFilter(void);
+    BloomFilter(const BloomFilter&) = delete;
+    BloomFilter& operator=(const BloomFilter&) = delete;
+    static int optimal_hashes(float);
+    void set(uint64_t);
+    void build(void);
+    bool is_set(uint64_t) const;
+    void save(string&) const;
 };
+
+#endif
@@ -1,71 +1,224 @@
 #include <iostream>
+#include <thread>
 
 #include "buffer.h"
 
 using namespace std;
 
-VAL_t * Buffer::get(KEY_t key) const {
-    entry_t search_entry;
-    set<entry_t>::iterator entry;
-    VAL_t *val;
-
-    search_entry.key = key;
-    // 在 缓存中 查找
-    entry = entries.find(search_entry);
-
-    if (entry == entries.end()) {
-        return nullptr;
-    } else {
-        // ...
-        val = new VAL_t;
-        *val = entry->val;
-        return val;
+Buffer::Buffer(int max_size) : max_size(max_size) {
+    empty();
+}
+
+Buffer::node * Buffer::new_node(KEY_t key, uint64_t stamp, int node_height) {
+    node *n;
+    int level;
+
+    // The tower of next pointers is laid out inline after the node
+    n = (node *)arena.allocate(sizeof(node) + (node_height - 1) * sizeof(atomic<node *>));
+    n->key = key;
+    n->stamp.store(stamp, memory_order_relaxed);
+    n->height = node_height;
+
+    for (level = 0; level < node_height; level++) {
+        n->next[level].store(nullptr, memory_order_relaxed);
     }
+
+    return n;
 }
 
-vector<entry_t> * Buffer::range(KEY_t start, KEY_t end) const {
-    entry_t search_entry;
-    set<entry_t>::iterator subrange_start, subrange_end;
+int Buffer::random_height(void) {
+    // Per thread, so that concurrent puts share no state
+    static thread_local uint64_t rand_state = 0x9e3779b97f4a7c15;
+    int node_height;
 
-    search_entry.key = start;
-    subrange_start = entries.lower_bound(search_entry);
+    node_height = 1;
 
-    search_entry.key = end;
-    subrange_end = entries.upper_bound(search_entry);
+    // xorshift64, cheap enough to run on every put
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 7;
+    rand_state ^= rand_state << 17;
 
-    /**
-     * start和end是下界和上界, 然后转成vector
-     */
-    return new vector<entry_t>(subrange_start, subrange_end);
+    while (node_height < BUFFER_MAX_HEIGHT
+           && ((rand_state >> (2 * node_height)) & (BUFFER_BRANCHING - 1)) == 0) {
+        node_height++;
+    }
+
+    return node_height;
+}
+
+/*
+ * Return the first node whose key is not less than the given key,
+ * optionally recording at every level the rightmost node visited and
+ * the node after it. Levels above the current height record the head
+ * and its successor, so a put can link in a taller node.
+ */
+Buffer::node * Buffer::find_greater_or_equal(KEY_t key, node **prev, node **succ) const {
+    node *current, *next;
+    int level;
+
+    current = head;
+    level = height.load(memory_order_acquire) - 1;
+
+    if (prev != nullptr) {
+        for (int above = BUFFER_MAX_HEIGHT - 1; above > level; above--) {
+            prev[above] = head;
+            succ[above] = head->next[above].load(memory_order_acquire);
+        }
+    }
+
+    while (true) {
+        next = current->next[level].load(memory_order_acquire);
+
+        if (next != nullptr && next->key < key) {
+            current = next;
+        } else {
+            if (prev != nullptr) {
+                prev[level] = current;
+                succ[level] = next;
+            }
+            if (level == 0) return next;
+            level--;
+        }
+    }
+}
+
+/*
+ * Overwrite a node's value, unless it already holds a later write.
+ * Sequence numbers are compared as in serial number arithmetic, so
+ * they may wrap around.
+ */
+void Buffer::update(node *n, uint64_t stamp) {
+    uint64_t current;
+
+    current = n->stamp.load(memory_order_acquire);
+
+    while ((int32_t)((uint32_t)(stamp >> 32) - (uint32_t)(current >> 32)) > 0
+           && !n->stamp.compare_exchange_weak(current, stamp)) {}
 }
 
-bool Buffer::put(KEY_t key, VAL_t val) {
-    entry_t entry;
-    set<entry_t>::iterator it;
-    bool found;
+bool Buffer::get(KEY_t key, VAL_t *val) const {
+    node *n;
+
+    n = find_greater_or_equal(key, nullptr, nullptr);
 
-    if (entries.size() == max_size) {
+    if (n == nullptr || n->key != key) {
+        return false;
+    }
+
+    *val = (VAL_t)(uint32_t)n->stamp.load(memory_order_acquire);
+    return true;
+}
+
+/*
+ * Register a put and reserve a slot for its entry. Returns false if
+ * the buffer is sealed or full, in which case the put must go to the
+ * next buffer. The writer count is raised before sealed is read, and
+ * seal sets sealed before reading the count, so either seal waits for
+ * the put or the put sees the seal.
+ */
+bool Buffer::enter(void) {
+    writers.fetch_add(1);
+
+    if (sealed.load()) {
+        writers.fetch_sub(1);
+        return false;
+    } else if (num_entries.fetch_add(1) >= max_size) {
+        num_entries.fetch_sub(1);
+        writers.fetch_sub(1);
         return false;
-    } else {
-        entry.key = key;
-        entry.val = val;
-
-        /**
-         * 在Linux上不一样能编译成功,
-         * tie用于对一个元组解包, 如果不行, 分别赋值就行啦
-         */
-        tie(it, found) = entries.insert(entry);
-
-        // Update the entry if it already exists
-        if (!found) {
-            entries.erase(it);
-            entries.insert(entry);
+    }
+
+    return true;
+}
+
+/*
+ * Insert or update an entry, between enter and leave. The slot
+ * reserved by enter is given back if the key is already present.
+ */
+void Buffer::put(KEY_t key, VAL_t val, uint32_t sequence) {
+    node *prev[BUFFER_MAX_HEIGHT], *succ[BUFFER_MAX_HEIGHT];
+    node *n, *found;
+    uint64_t stamp;
+    int node_height, current_height, level;
+
+    stamp = (uint64_t)sequence << 32 | (uint32_t)val;
+    n = nullptr;
+    node_height = 0;
+
+    /*
+     * Link the node in at the bottom level first: once there, it is
+     * in the list. A failed compare-and-swap means another put got in
+     * between, possibly with the same key, so search again.
+     */
+
+    while (true) {
+        found = find_greater_or_equal(key, prev, succ);
+
+        // Update the entry in place if it already exists
+        if (found != nullptr && found->key == key) {
+            update(found, stamp);
+            num_entries.fetch_sub(1);
+            return;
+        }
+
+        if (n == nullptr) {
+            node_height = random_height();
+            n = new_node(key, stamp, node_height);
+        }
+
+        n->next[0].store(succ[0], memory_order_relaxed);
+
+        if (prev[0]->next[0].compare_exchange_strong(succ[0], n)) break;
+    }
+
+    current_height = height.load();
+
+    while (node_height > current_height
+           && !height.compare_exchange_weak(current_height, node_height)) {}
+
+    /*
+     * Then link it in at the levels above, looking for the new place
+     * from the previous one whenever a concurrent put got in first
+     */
+
+    for (level = 1; level < node_height; level++) {
+        while (true) {
+            n->next[level].store(succ[level], memory_order_relaxed);
+
+            if (prev[level]->next[level].compare_exchange_strong(succ[level], n)) break;
+
+            while (succ[level] != nullptr && succ[level]->key < key) {
+                prev[level] = succ[level];
+                succ[level] = prev[level]->next[level].load(memory_order_acquire);
+            }
         }
+    }
+}
+
+/*
+ * Refuse new puts, and wait for those in flight to leave
+ */
+void Buffer::seal(void) {
+    sealed.store(true);
 
-        return true;
+    while (writers.load() > 0) {
+        this_thread::yield();
     }
 }
 
 void Buffer::empty(void) {
-    entries.clear();
+    int level;
+
+    arena.reset();
+
+    head = new_node(KEY_MIN, 0, BUFFER_MAX_HEIGHT);
+
+    for (level = 0; level < BUFFER_MAX_HEIGHT; level++) {
+        head->next[level].store(nullptr, memory_order_relaxed);
+    }
+
+    height.store(1);
+    num_entries.store(0);
+    writers.store(0);
+    sealed.store(false);
 }
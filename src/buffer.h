@@ -1,17 +1,81 @@
-#include <set>
+#ifndef BUFFER_H
+#define BUFFER_H
+
+#include <atomic>
+#include <cstdint>
 #include <vector>
 
+#include "arena.h"
 #include "types.h"
 
+#define BUFFER_MAX_HEIGHT 12
+#define BUFFER_BRANCHING 4
+
 using namespace std;
 
+/*
+ * The buffer is a skip list whose nodes live in an arena, so inserts
+ * do not allocate, updates overwrite the value in place, and the
+ * entries can be walked in key order when flushing to level 0.
+ *
+ * Puts may run on many threads at once. Nodes are linked in with a
+ * compare-and-swap at each level and are never unlinked, so readers
+ * need no locks either. Every write carries a sequence number, and
+ * of two writes to a key the later sequence number wins, whichever
+ * reaches the buffer first.
+ */
 class Buffer {
+    struct node {
+        KEY_t key;
+        // Sequence number of the last write in the high half, its
+        // value in the low half, so both change together
+        atomic<uint64_t> stamp;
+        int height;
+        atomic<node *> next[1];
+    };
+    Arena arena;
+    node *head;
+    atomic<int> height;
+    // Entries, counting the slots reserved by puts in flight
+    atomic<long> num_entries;
+    // Puts between enter and leave, and whether new ones are refused
+    atomic<int> writers;
+    atomic<bool> sealed;
+    node * new_node(KEY_t, uint64_t, int);
+    int random_height(void);
+    node * find_greater_or_equal(KEY_t, node **, node **) const;
+    static void update(node *, uint64_t);
 public:
+    class iterator {
+        const node *current;
+    public:
+        iterator(const node *n) : current(n) {}
+        entry_t operator*(void) const {
+            return {current->key, (VAL_t)(uint32_t)current->stamp.load(memory_order_acquire)};
+        }
+        iterator& operator++(void) {
+            current = current->next[0].load(memory_order_acquire);
+            return *this;
+        }
+        bool operator==(const iterator& other) const {return current == other.current;}
+        bool operator!=(const iterator& other) const {return current != other.current;}
+    };
     int max_size;
-    set<entry_t> entries;
-    Buffer(int max_size) : max_size(max_size) {};
-    VAL_t * get(KEY_t) const;
-    vector<entry_t> * range(KEY_t, KEY_t) const;
-    bool put(KEY_t, VAL_t val);
+    Buffer(int);
+    bool get(KEY_t, VAL_t *) const;
+    bool enter(void);
+    void put(KEY_t, VAL_t, uint32_t);
+    void leave(void) {writers.fetch_sub(1);}
+    void seal(void);
     void empty(void);
+    long size(void) const {return num_entries.load();}
+    bool full(void) const {return num_entries.load() >= max_size;}
+    iterator begin(void) const {return iterator(head->next[0].load(memory_order_acquire));}
+    iterator end(void) const {return iterator(nullptr);}
+    // The first entry whose key is not less than the given key
+    iterator lower_bound(KEY_t key) const {
+        return iterator(find_greater_or_equal(key, nullptr, nullptr));
+    }
 };
+
+#endif
@@ -0,0 +1,135 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdlib>
+
+#include "fence_index.h"
+#include "sys.h"
+
+using namespace std;
+
+FenceIndex::~FenceIndex(void) {
+    free(eytzinger);
+}
+
+void FenceIndex::assign(const KEY_t *new_keys, long n) {
+    keys.assign(new_keys, new_keys + n);
+}
+
+/*
+ * Fill the subtree rooted at node k with the keys from position i on,
+ * in order
+ */
+void FenceIndex::build_eytzinger(long& i, long k) {
+    if (k <= keys.size()) {
+        build_eytzinger(i, 2 * k);
+        eytzinger[k] = keys[i];
+        eytzinger_rank[k] = i++;
+        build_eytzinger(i, 2 * k + 1);
+    }
+}
+
+/*
+ * Split the keys into segments in which a line predicts the position
+ * of every key within LEARNED_FENCE_MAX_ERROR. Each segment narrows
+ * the range of slopes that keep all of its keys within the error,
+ * and ends once that range is empty.
+ */
+void FenceIndex::build_segments(void) {
+    segment current;
+    double low, high, dx, dy;
+    long i;
+
+    current.key = keys[0];
+    current.start = 0;
+    low = 0;
+    high = INFINITY;
+
+    for (i = 1; i < keys.size(); i++) {
+        dx = (double)keys[i] - current.key;
+        dy = i - current.start;
+
+        if (max(low, (dy - LEARNED_FENCE_MAX_ERROR) / dx)
+            <= min(high, (dy + LEARNED_FENCE_MAX_ERROR) / dx)) {
+            low = max(low, (dy - LEARNED_FENCE_MAX_ERROR) / dx);
+            high = min(high, (dy + LEARNED_FENCE_MAX_ERROR) / dx);
+            continue;
+        }
+
+        current.end = i;
+        current.slope = (high == INFINITY) ? low : (low + high) / 2;
+        segments.push_back(current);
+
+        current.key = keys[i];
+        current.start = i;
+        low = 0;
+        high = INFINITY;
+    }
+
+    current.end = keys.size();
+    current.slope = (high == INFINITY) ? low : (low + high) / 2;
+    segments.push_back(current);
+}
+
+void FenceIndex::build(void) {
+    long i;
+
+    assert(!keys.empty());
+
+    if (layout == FENCE_EYTZINGER) {
+        if (posix_memalign((void **)&eytzinger, FENCE_INDEX_ALIGNMENT,
+                           (keys.size() + 1) * sizeof(KEY_t)) != 0) {
+            die("Could not allocate fence index.");
+        }
+
+        eytzinger_rank.resize(keys.size() + 1);
+        i = 0;
+        build_eytzinger(i, 1);
+    } else if (layout == FENCE_LEARNED) {
+        build_segments();
+    }
+}
+
+/*
+ * Return the index of the page that may hold the key, i.e. the last
+ * one whose first key is not above it, or -1 if there is none
+ */
+long FenceIndex::find(KEY_t key) const {
+    vector<segment>::const_iterator next_segment;
+    long n, k, predicted, begin, end;
+
+    n = keys.size();
+
+    if (key < keys[0]) {
+        return -1;
+    } else if (layout == FENCE_EYTZINGER) {
+        /*
+         * Walk down to a leaf, going right past keys not above the
+         * key. The node of the first key above it is where the walk
+         * last went left, found from the trailing ones in k.
+         */
+        k = 1;
+
+        while (k <= n) {
+            __builtin_prefetch(eytzinger + 16 * k);
+            k = 2 * k + (eytzinger[k] <= key);
+        }
+
+        k >>= __builtin_ffsl(~k);
+
+        return ((k == 0) ? n : eytzinger_rank[k]) - 1;
+    } else if (layout == FENCE_LEARNED) {
+        next_segment = upper_bound(segments.begin(), segments.end(), key,
+                                   [](KEY_t k, const segment& s) {return k < s.key;});
+        const segment& s = *(next_segment - 1);
+
+        predicted = s.start + (long)(s.slope * ((double)key - s.key));
+        predicted = min(max(predicted, s.start), s.end - 1);
+        begin = max(predicted - LEARNED_FENCE_MAX_ERROR - 1, s.start);
+        end = min(predicted + LEARNED_FENCE_MAX_ERROR + 2, s.end);
+
+        return (upper_bound(keys.begin() + begin, keys.begin() + end, key) - keys.begin()) - 1;
+    }
+
+    return (upper_bound(keys.begin(), keys.end(), key) - keys.begin()) - 1;
+}
@@ -0,0 +1,57 @@
+#ifndef FENCE_INDEX_H
+#define FENCE_INDEX_H
+
+#include <vector>
+
+#include "types.h"
+
+#define FENCE_INDEX_ALIGNMENT 64
+#define LEARNED_FENCE_MAX_ERROR 8
+
+using namespace std;
+
+/*
+ * How a file searches its fence pointers: a binary search over the
+ * sorted keys, a search over the keys laid out in breadth-first
+ * (Eytzinger) order, where the next four levels of the tree always
+ * share one cache line, or a piecewise linear model of key to page
+ * followed by a search of the few pages it can be wrong by.
+ */
+enum fence_layout {FENCE_BINARY, FENCE_EYTZINGER, FENCE_LEARNED};
+
+typedef enum fence_layout fence_layout_t;
+
+/*
+ * Index over the first key of every page of a file. Keys are added in
+ * order while the file is written, and the index is built once all
+ * of them are known.
+ */
+class FenceIndex {
+    struct segment {
+        KEY_t key;
+        long start, end;
+        double slope;
+    };
+    fence_layout_t layout;
+    vector<KEY_t> keys;
+    // Keys in Eytzinger order from index 1, and their sorted positions
+    KEY_t *eytzinger;
+    vector<long> eytzinger_rank;
+    vector<segment> segments;
+    void build_eytzinger(long&, long);
+    void build_segments(void);
+public:
+    FenceIndex(fence_layout_t l) : layout(l), eytzinger(nullptr) {}
+    ~FenceIndex(void);
+    FenceIndex(const FenceIndex&) = delete;
+    FenceIndex& operator=(const FenceIndex&) = delete;
+    void reserve(long n) {keys.reserve(n);}
+    void push_back(KEY_t key) {keys.push_back(key);}
+    void assign(const KEY_t *, long);
+    void build(void);
+    long find(KEY_t) const;
+    long size(void) const {return keys.size();}
+    const vector<KEY_t>& get_keys(void) const {return keys;}
+};
+
+#endif
@@ -0,0 +1,48 @@
+#include <cstring>
+
+#include "bloom_filter.h"
+#include "filter.h"
+#include "fuse_filter.h"
+#include "sys.h"
+
+/*
+ * 64-bit finalizer from MurmurHash3. It is a bijection, so distinct
+ * keys always have distinct hashes.
+ */
+uint64_t Filter::mix(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+
+    return key;
+}
+
+/*
+ * Make an empty filter, sized for the keys it gets when it is built
+ */
+Filter * Filter::create(filter_family_t family, float bits_per_entry) {
+    if (family == FILTER_FUSE && bits_per_entry >= FUSE_MIN_BITS_PER_ENTRY) {
+        return new BinaryFuseFilter(bits_per_entry >= 2 * FUSE_MIN_BITS_PER_ENTRY ? 16 : 8);
+    }
+
+    return new BloomFilter(bits_per_entry);
+}
+
+Filter * Filter::load(const char *data, size_t length) {
+    int64_t family;
+
+    if (length < sizeof(family)) die("Corrupt filter.");
+
+    memcpy(&family, data, sizeof(family));
+
+    if (family == FILTER_BLOOM) {
+        return new BloomFilter(data + sizeof(family), length - sizeof(family));
+    } else if (family == FILTER_FUSE) {
+        return new BinaryFuseFilter(data + sizeof(family), length - sizeof(family));
+    }
+
+    die("Corrupt filter.");
+    return nullptr;
+}
@@ -0,0 +1,41 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <cstdint>
+#include <string>
+
+#include "types.h"
+
+using namespace std;
+
+/*
+ * Both kinds of filter are built once all keys of a file are known,
+ * and sized for them. Binary fuse filters use fewer bits for the same
+ * false positive rate, but need at least FUSE_MIN_BITS_PER_ENTRY bits
+ * per entry: below that, files get a Bloom filter anyway.
+ */
+enum filter_family {FILTER_BLOOM, FILTER_FUSE};
+
+typedef enum filter_family filter_family_t;
+
+/*
+ * Approximate membership filter of a run file. Keys are added by
+ * their hash while the file is written, and the filter is built when
+ * the file is sealed. Lookups hash a key once and probe every file's
+ * filter with the same hash.
+ */
+class Filter {
+public:
+    virtual ~Filter(void) {}
+    virtual void set(uint64_t) = 0;
+    virtual void build(void) {}
+    virtual bool is_set(uint64_t) const = 0;
+    // Append the filter, starting with its family, to a string
+    virtual void save(string&) const = 0;
+    static uint64_t mix(uint64_t);
+    static uint64_t hash(KEY_t k) {return mix((uint32_t)k);}
+    static Filter * create(filter_family_t, float);
+    static Filter * load(const char *, size_t);
+};
+
+#endif
@@ -0,0 +1,188 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+
+#include "fuse_filter.h"
+#include "sys.h"
+
+using namespace std;
+
+/*
+ * Restore a filter saved with save
+ */
+BinaryFuseFilter::BinaryFuseFilter(const char *data, size_t length) {
+    int64_t header[5];
+
+    if (length < sizeof(header)) die("Corrupt fuse filter.");
+
+    memcpy(header, data, sizeof(header));
+
+    fingerprint_bits = header[0];
+    seed = header[1];
+    segment_length = header[2];
+    segment_count_length = header[3];
+    array_length = header[4];
+
+    if ((fingerprint_bits != 8 && fingerprint_bits != 16)
+        || length != sizeof(header) + array_length * fingerprint_bits / 8) {
+        die("Corrupt fuse filter.");
+    }
+
+    fingerprints.assign(data + sizeof(header), data + length);
+}
+
+uint64_t BinaryFuseFilter::mix(uint64_t hash) const {
+    return Filter::mix(hash + seed);
+}
+
+/*
+ * The first slot lies in one of the first segment_count segments,
+ * the other two at the same offset in the next two segments, each
+ * moved within its segment by other bits of the hash.
+ */
+void BinaryFuseFilter::positions(uint64_t hash, uint32_t *slots) const {
+    slots[0] = (uint32_t)(((__uint128_t)hash * segment_count_length) >> 64);
+    slots[1] = (slots[0] + segment_length) ^ ((uint32_t)(hash >> 18) & (segment_length - 1));
+    slots[2] = (slots[0] + 2 * segment_length) ^ ((uint32_t)hash & (segment_length - 1));
+}
+
+uint32_t BinaryFuseFilter::fingerprint(uint64_t hash) const {
+    return (uint32_t)(hash ^ (hash >> 32)) & ((1U << fingerprint_bits) - 1);
+}
+
+uint32_t BinaryFuseFilter::get_slot(uint32_t slot) const {
+    uint16_t value;
+
+    if (fingerprint_bits == 8) return fingerprints[slot];
+
+    memcpy(&value, &fingerprints[2 * slot], sizeof(value));
+    return value;
+}
+
+void BinaryFuseFilter::set_slot(uint32_t slot, uint32_t value) {
+    uint16_t wide;
+
+    if (fingerprint_bits == 8) {
+        fingerprints[slot] = value;
+    } else {
+        wide = value;
+        memcpy(&fingerprints[2 * slot], &wide, sizeof(wide));
+    }
+}
+
+/*
+ * Repeatedly take out a key that is alone in one of its slots,
+ * recording the key and that slot. Succeeds if every key comes out.
+ */
+bool BinaryFuseFilter::peel(vector<pair<uint64_t, uint32_t>>& order) {
+    vector<uint32_t> counts, queue;
+    vector<uint64_t> xors;
+    uint32_t slots[3], slot;
+    uint64_t hash;
+    int i;
+
+    counts.assign(array_length, 0);
+    xors.assign(array_length, 0);
+    order.clear();
+
+    for (auto key_hash : hashes) {
+        hash = mix(key_hash);
+        positions(hash, slots);
+
+        for (i = 0; i < 3; i++) {
+            counts[slots[i]]++;
+            xors[slots[i]] ^= hash;
+        }
+    }
+
+    for (slot = 0; slot < array_length; slot++) {
+        if (counts[slot] == 1) queue.push_back(slot);
+    }
+
+    while (!queue.empty()) {
+        slot = queue.back();
+        queue.pop_back();
+
+        if (counts[slot] != 1) continue;
+
+        hash = xors[slot];
+        order.push_back({hash, slot});
+        positions(hash, slots);
+
+        for (i = 0; i < 3; i++) {
+            counts[slots[i]]--;
+            xors[slots[i]] ^= hash;
+            if (counts[slots[i]] == 1) queue.push_back(slots[i]);
+        }
+    }
+
+    return order.size() == hashes.size();
+}
+
+/*
+ * Size the segments for the number of keys, peel the keys and fill
+ * in the slots in reverse peeling order: each key's slot is the last
+ * of its three to be written, so it can make them xor to the key's
+ * fingerprint.
+ */
+void BinaryFuseFilter::build(void) {
+    vector<pair<uint64_t, uint32_t>> order;
+    uint32_t slots[3];
+    long n, capacity, segment_count;
+    double size_factor;
+    int attempt;
+
+    n = hashes.size();
+
+    segment_length = (n <= 1) ? 4 : 1U << (int)floor(log(n) / log(3.33) + 2.25);
+    segment_length = min(segment_length, (uint32_t)FUSE_MAX_SEGMENT_LENGTH);
+    size_factor = (n <= 1) ? 0 : max(1.125, 0.875 + 0.25 * log(1000000) / log(n));
+    capacity = lround(n * size_factor);
+
+    segment_count = (capacity + segment_length - 1) / segment_length;
+    segment_count = max(segment_count - 2, (long)1);
+    array_length = (segment_count + 2) * segment_length;
+    segment_count_length = segment_count * segment_length;
+
+    for (attempt = 0; attempt < FUSE_MAX_ATTEMPTS; attempt++) {
+        seed = Filter::hash(attempt) + attempt;
+        if (peel(order)) break;
+    }
+
+    if (attempt == FUSE_MAX_ATTEMPTS) die("Could not build fuse filter.");
+
+    fingerprints.assign(array_length * fingerprint_bits / 8, 0);
+
+    for (auto it = order.rbegin(); it != order.rend(); it++) {
+        positions(it->first, slots);
+        set_slot(it->second, fingerprint(it->first)
+                             ^ get_slot(slots[0]) ^ get_slot(slots[1]) ^ get_slot(slots[2]));
+    }
+
+    hashes.clear();
+    hashes.shrink_to_fit();
+}
+
+bool BinaryFuseFilter::is_set(uint64_t hash) const {
+    uint32_t slots[3];
+
+    hash = mix(hash);
+    positions(hash, slots);
+
+    return fingerprint(hash) == (get_slot(slots[0]) ^ get_slot(slots[1]) ^ get_slot(slots[2]));
+}
+
+void BinaryFuseFilter::save(string& out) const {
+    int64_t header[6];
+
+    header[0] = FILTER_FUSE;
+    header[1] = fingerprint_bits;
+    header[2] = seed;
+    header[3] = segment_length;
+    header[4] = segment_count_length;
+    header[5] = array_length;
+
+    out.append((const char *)header, sizeof(header));
+    out.append((const char *)fingerprints.data(), fingerprints.size());
+}
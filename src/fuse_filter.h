@@ -0,0 +1,49 @@
+#ifndef FUSE_FILTER_H
+#define FUSE_FILTER_H
+
+#include <cstdint>
+#include <vector>
+
+#include "filter.h"
+
+#define FUSE_MIN_BITS_PER_ENTRY 9
+#define FUSE_MAX_SEGMENT_LENGTH 262144
+#define FUSE_MAX_ATTEMPTS 100
+
+using namespace std;
+
+/*
+ * Binary fuse filter (Graf and Lemire): an array of 8 or 16-bit
+ * fingerprints split into segments, where every key maps to one slot
+ * in each of three consecutive segments, and the three slots xor to
+ * the key's fingerprint. A probe reads three slots, and the filter
+ * takes about 12.5% more bits than the fingerprints for a false
+ * positive rate of 2^-bits. The slots are solved by peeling once all
+ * keys are known, retrying with another seed in the rare case the
+ * keys do not peel.
+ */
+class BinaryFuseFilter : public Filter {
+    vector<uint64_t> hashes;
+    vector<uint8_t> fingerprints;
+    int fingerprint_bits;
+    uint64_t seed;
+    uint32_t segment_length, segment_count_length;
+    long array_length;
+    uint64_t mix(uint64_t) const;
+    void positions(uint64_t, uint32_t *) const;
+    uint32_t fingerprint(uint64_t) const;
+    uint32_t get_slot(uint32_t) const;
+    void set_slot(uint32_t, uint32_t);
+    bool peel(vector<pair<uint64_t, uint32_t>>&);
+public:
+    BinaryFuseFilter(int bits) : fingerprint_bits(bits), seed(0),
+                                 segment_length(0), segment_count_length(0),
+                                 array_length(0) {}
+    BinaryFuseFilter(const char *, size_t);
+    void set(uint64_t hash) {hashes.push_back(hash);}
+    void build(void);
+    bool is_set(uint64_t) const;
+    void save(string&) const;
+};
+
+#endif
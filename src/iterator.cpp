@@ -0,0 +1,113 @@
+#include <algorithm>
+#include <functional>
+
+#include "block_cache.h"
+#include "iterator.h"
+
+/*
+ * Run cursors
+ */
+
+RunCursor::RunCursor(shared_ptr<Run> r) : run(r), file_index(r->files.size()),
+                                          page_index(0), position(0), pages_read(0) {
+    page.size = 0;
+}
+
+void RunCursor::read_page(void) {
+    const RunFile *file;
+
+    file = run->files[file_index].get();
+    page = file->read_page(page_index, pinned, pages_read++ >= BLOCK_CACHE_SCAN_PAGES);
+    position = 0;
+}
+
+void RunCursor::seek(KEY_t key) {
+    // The first file that may hold the key or anything after it
+    file_index = lower_bound(run->files.begin(), run->files.end(), key,
+                             [](const shared_ptr<RunFile>& file, KEY_t k) {
+                                 return file->max_key < k;
+                             }) - run->files.begin();
+
+    if (!valid()) return;
+
+    page_index = max(run->files[file_index]->find_page(key), (long)0);
+    read_page();
+
+    // Start at the first key not below the one sought, which may be
+    // on the next page
+    position = lower_bound(page.keys, page.keys + page.size, key) - page.keys;
+    if (position == page.size) {
+        position--;
+        next();
+    }
+}
+
+void RunCursor::next(void) {
+    if (++position < page.size) return;
+
+    if (++page_index == run->files[file_index]->num_pages()) {
+        if (++file_index == run->files.size()) return;
+        page_index = 0;
+    }
+
+    read_page();
+}
+
+/*
+ * Merging iterator
+ */
+
+void MergingIterator::add(unique_ptr<Cursor> cursor) {
+    cursors.push_back(move(cursor));
+}
+
+void MergingIterator::push(int index) {
+    if (!cursors[index]->valid()) return;
+
+    heap.push_back((int64_t)cursors[index]->key() * ((int64_t)1 << 32) + index);
+    push_heap(heap.begin(), heap.end(), greater<int64_t>());
+}
+
+void MergingIterator::seek(KEY_t key) {
+    int i;
+
+    heap.clear();
+
+    for (i = 0; i < cursors.size(); i++) {
+        cursors[i]->seek(key);
+        push(i);
+    }
+
+    find_next();
+}
+
+/*
+ * Take the entry of the cursor with the smallest key, first added
+ * wins, and move every cursor at that key past it
+ */
+void MergingIterator::find_next(void) {
+    int index;
+
+    while (!heap.empty()) {
+        index = heap.front() & 0xffffffff;
+
+        if (cursors[index]->key() > upper_bound) break;
+
+        current = cursors[index]->entry();
+
+        while (!heap.empty() && heap.front() >> 32 == current.key) {
+            index = heap.front() & 0xffffffff;
+            pop_heap(heap.begin(), heap.end(), greater<int64_t>());
+            heap.pop_back();
+            cursors[index]->next();
+            push(index);
+        }
+
+        if (current.val != VAL_TOMBSTONE) {
+            is_valid = true;
+            return;
+        }
+    }
+
+    is_valid = false;
+}
@@ -0,0 +1,89 @@
+#ifndef ITERATOR_H
+#define ITERATOR_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "buffer.h"
+#include "run.h"
+#include "types.h"
+
+using namespace std;
+
+/*
+ * Position in one sorted source of entries: a buffer or a run
+ */
+class Cursor {
+public:
+    virtual ~Cursor(void) {}
+    // Move to the first entry with a key not less than the given one
+    virtual void seek(KEY_t) = 0;
+    virtual void next(void) = 0;
+    virtual bool valid(void) const = 0;
+    virtual KEY_t key(void) const = 0;
+    virtual entry_t entry(void) const = 0;
+};
+
+class BufferCursor : public Cursor {
+    shared_ptr<const Buffer> buffer;
+    Buffer::iterator current;
+public:
+    BufferCursor(shared_ptr<const Buffer> b) : buffer(b), current(b->end()) {}
+    void seek(KEY_t key) {current = buffer->lower_bound(key);}
+    void next(void) {++current;}
+    bool valid(void) const {return current != buffer->end();}
+    KEY_t key(void) const {return (*current).key;}
+    entry_t entry(void) const {return *current;}
+};
+
+/*
+ * Reads a run one page at a time, holding only the current page.
+ * After the first few pages, the pages read count as a scan for the
+ * block cache.
+ */
+class RunCursor : public Cursor {
+    shared_ptr<Run> run;
+    pinned_page_t pinned;
+    run_page_t page;
+    size_t file_index;
+    long page_index, position, pages_read;
+    void read_page(void);
+public:
+    RunCursor(shared_ptr<Run>);
+    void seek(KEY_t);
+    void next(void);
+    bool valid(void) const {return file_index < run->files.size();}
+    KEY_t key(void) const {return page.keys[position];}
+    entry_t entry(void) const {return {page.keys[position], page.vals[position]};}
+};
+
+/*
+ * Merges cursors into one sorted stream of live entries. Cursors
+ * added earlier take precedence for a key, and keys whose latest
+ * entry is a tombstone are skipped. A min-heap on key and precedence
+ * picks the next entry, so memory stays at one page per run however
+ * many entries the scan returns. Keys past the upper bound end the
+ * scan.
+ */
+class MergingIterator {
+    vector<unique_ptr<Cursor>> cursors;
+    // Key and cursor index of every valid cursor, packed like
+    // merge_entry::order
+    vector<int64_t> heap;
+    entry_t current;
+    bool is_valid;
+    KEY_t upper_bound;
+    void push(int);
+    void find_next(void);
+public:
+    MergingIterator(KEY_t u = KEY_MAX) : is_valid(false), upper_bound(u) {}
+    void add(unique_ptr<Cursor>);
+    void seek(KEY_t);
+    void next(void) {find_next();}
+    bool valid(void) const {return is_valid;}
+    KEY_t key(void) const {return current.key;}
+    VAL_t value(void) const {return current.val;}
+};
+
+#endif
@@ -1,13 +1,41 @@
+#include <memory>
 #include <queue>
 
 #include "run.h"
 
+/*
+ * A tiered level keeps up to max_runs runs side by side, a leveled
+ * level merges everything it receives into a single run.
+ */
+enum merge_policy {TIERING, LEVELING};
+
+typedef enum merge_policy merge_policy_t;
+
 class Level {
 public:
     // 一个Level包含多个runs
     int max_runs;
     long max_run_size;
-    std::deque<Run> runs;
-    Level(int n, long s) : max_runs(n), max_run_size(s) {}
-    bool remaining(void) const {return max_runs - runs.size();}
+    merge_policy_t policy;
+    // Runs are shared so that a background merge can keep reading
+    // its inputs without holding the tree lock
+    std::deque<std::shared_ptr<Run>> runs;
+    // Set while the level is the source or target of a merge
+    bool merging;
+    Level(int n, long s, merge_policy_t p) : max_runs(n), max_run_size(s),
+                                             policy(p), merging(false) {}
+    long capacity(void) const {return max_runs * max_run_size;}
+    long num_entries(void) const {
+        long total = 0;
+        for (const auto& run : runs) total += run->size;
+        return total;
+    }
+    // Number of max_run_size runs the level can still take in
+    long remaining(void) const {
+        if (policy == TIERING) {
+            return max_runs - (long)runs.size();
+        } else {
+            return (capacity() - num_entries()) / max_run_size;
+        }
+    }
 };
@@ -1,7 +1,18 @@
+#include <algorithm>
 #include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <dirent.h>
+#include <fcntl.h>
 #include <fstream>
 #include <iostream>
 #include <map>
+#include <set>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "lsm_tree.h"
 #include "merge.h"
@@ -26,168 +37,1029 @@ istream& operator>>(istream& stream, entry_t& entry) {
  */
 
 LSMTree::LSMTree(int buffer_max_entries, int depth, int fanout,
-                 int num_threads, float bf_bits_per_entry) :
+                 int num_threads, int num_compaction_threads,
+                 float bf_bits_per_entry, bool last_level_filters,
+                 const vector<merge_policy_t>& merge_policies,
+                 long file_max_size, fence_layout_t fence_layout,
+                 filter_family_t filter_family, float range_filter_bits,
+                 size_t block_cache_size) :
+                 buffers{make_shared<Buffer>(buffer_max_entries),
+                         make_shared<Buffer>(buffer_max_entries)},
+                 flush_pool(1),
+                 worker_pool(num_threads),
+                 merge_pool(num_threads),
                  bf_bits_per_entry(bf_bits_per_entry),
-                 buffer(buffer_max_entries),
-                 worker_pool(num_threads)
+                 last_level_filters(last_level_filters),
+                 file_config(make_shared<RunFileConfig>(file_max_size, fence_layout,
+                                                        filter_family, range_filter_bits))
 {
     long max_run_size;
+    int i;
+
+    buffer = buffers[0];
+    immutable_buffer = nullptr;
+    next_sequence = 0;
+    log_sequence_base = 0;
+    replaying = false;
+    merges_in_flight = 0;
+    shutting_down = false;
+    lookup_ns = 0;
 
     max_run_size = buffer_max_entries;
 
-    while ((depth--) > 0) {
-        levels.emplace_back(fanout, max_run_size);
+    assert(!merge_policies.empty());
+
+    if (block_cache_size > 0) {
+        file_config->block_cache = make_shared<BlockCache>(block_cache_size);
+    }
+
+    // The last policy given applies to all remaining levels
+    for (i = 0; i < depth; i++) {
+        levels.emplace_back(fanout, max_run_size,
+                            merge_policies[min(i, (int)merge_policies.size() - 1)]);
         max_run_size *= fanout;
     }
+
+    install_version();
+
+    // Flushes wait on the compaction threads, so there must be one
+    num_compaction_threads = max(num_compaction_threads, 1);
+
+    while ((num_compaction_threads--) > 0) {
+        compaction_threads.emplace_back(&LSMTree::compaction_loop, this);
+    }
 }
 
-void LSMTree::merge_down(vector<Level>::iterator current) {
-    vector<Level>::iterator next;
-    MergeContext merge_ctx;
-    entry_t entry;
+LSMTree::~LSMTree(void) {
+    // Let an in-flight flush finish before the levels go away
+    if (flush_future.valid()) flush_future.wait();
 
-    assert(current >= levels.begin());
+    /*
+     * With a data directory, flush what is left in the active buffer
+     * too, so that every acknowledged write is kept. This waits for
+     * merges to make room in level 0 like any other flush.
+     */
 
-    /**
-     * 合法性判断
-     * 1. current是否还能插入一个run, 如果可以, 直接return, 现在可以继续插入元素了
-     * 2. 如果达到了最大的那一层Level, 则无法继续进行, 因为没有空间了
+    if (file_config->persistent() && buffer->size() > 0 && swap_buffers(buffer.get()).ok()) {
+        flush_future.wait();
+    }
+
+    {
+        lock_guard<mutex> guard(levels_lock);
+        shutting_down = true;
+    }
+
+    levels_changed.notify_all();
+
+    for (auto& compaction_thread : compaction_threads) {
+        compaction_thread.join();
+    }
+
+    /*
+     * The manifest lists every file still in the levels, so they
+     * must outlive the tree
      */
-    if (current->remaining() > 0) {
-        return;
-    } else if (current >= levels.end() - 1) {
-        die("No more space in tree.");
-    } else {
+
+    if (file_config->persistent()) {
+        {
+            lock_guard<mutex> guard(levels_lock);
+            save_manifest();
+        }
+
+        for (auto& level : levels) {
+            for (auto& run : level.runs) {
+                for (auto& file : run->files) file->keep = true;
+            }
+        }
+    }
+}
+
+/*
+ * Find a level that needs a merge. A leveled level that has received
+ * runs is merged into a single run first. Otherwise a level is merged
+ * into the one below as soon as it fills up, so that the next flush
+ * or merge into it finds space without waiting. Deeper levels are
+ * preferred since merging them makes room for the levels above. Must
+ * be called with levels_lock held.
+ */
+vector<Level>::iterator LSMTree::pick_merge(void) {
+    vector<Level>::iterator current, next;
+    int i;
+
+    for (i = (int)levels.size() - 1; i >= 0; i--) {
+        current = levels.begin() + i;
         next = current + 1;
+
+        if (current->merging) {
+            continue;
+        } else if (current->policy == LEVELING && current->runs.size() > 1) {
+            return current;
+        } else if (next != levels.end() && current->remaining() <= 0
+                   && next->remaining() > 0 && !next->merging) {
+            return current;
+        }
+    }
+
+    return levels.end();
+}
+
+void LSMTree::compaction_loop(void) {
+    vector<Level>::iterator current, next;
+    bool in_place;
+    unique_lock<mutex> guard(levels_lock);
+
+    while (true) {
+        levels_changed.wait(guard, [&] {
+            return shutting_down || (current = pick_merge()) != levels.end();
+        });
+
+        if (shutting_down) return;
+
+        in_place = (current->policy == LEVELING && current->runs.size() > 1);
+        next = in_place ? current : current + 1;
+
+        current->merging = true;
+        next->merging = true;
+        merges_in_flight++;
+
+        guard.unlock();
+
+        if (in_place) {
+            merge_level(current);
+        } else {
+            merge_down(current);
+        }
+
+        guard.lock();
+
+        current->merging = false;
+        next->merging = false;
+        merges_in_flight--;
+
+        levels_changed.notify_all();
+    }
+}
+
+/*
+ * Bits per entry for the filters of a run about to be written into
+ * the given level, which is receiving the given number of entries.
+ * Following Monkey, the tree's total filter budget is split so that
+ * the false positive rate of every run is proportional to its size,
+ * which minimizes the sum of false positive rates a lookup pays for
+ * across all runs: small, shallow runs get more bits per entry than
+ * large, deep ones. The split follows the current sizes of the levels,
+ * so it changes as they grow. Without last level filters, the last
+ * level gets none and its share of the budget goes to the others.
+ * Must be called with levels_lock held.
+ */
+float LSMTree::filter_bits_per_entry(vector<Level>::iterator target, long incoming) {
+    vector<double> level_entries, run_entries;
+    double budget, total, low, high, scale, bits;
+    long n;
+    int i, j;
+
+    auto bits_for = [](double false_positive_rate) {
+        return (false_positive_rate >= 1) ? 0 : -log(false_positive_rate) / (M_LN2 * M_LN2);
+    };
+
+    if (!last_level_filters && target == levels.end() - 1) {
+        return 0;
+    }
+
+    total = 0;
+
+    for (auto level = levels.begin(); level != levels.end(); level++) {
+        n = level->num_entries() + ((level == target) ? incoming : 0);
+        total += n;
+
+        if (n == 0 || (!last_level_filters && level == levels.end() - 1)) {
+            continue;
+        }
+
+        level_entries.push_back(n);
+
+        if (level->policy == TIERING) {
+            run_entries.push_back((double)n / (level->runs.size() + ((level == target) ? 1 : 0)));
+        } else {
+            run_entries.push_back(n);
+        }
     }
 
+    budget = bf_bits_per_entry * total;
+
+    if (budget <= 0) return 0;
+
     /*
-     * If the next level does not have space for the current level,
-     * recursively merge the next level downwards to create some
-     * 判断下一层是否有run空间，如果没有，则递归地调用merge_down，为本层留出一个run的空间
+     * Search for the scale of the false positive rates (in log space)
+     * at which the filters use up the budget
      */
 
-    if (next->remaining() == 0) {
-        merge_down(next);
-        assert(next->remaining() > 0);
+    low = -200;
+    high = 0;
+
+    for (i = 0; i < 64; i++) {
+        scale = (low + high) / 2;
+        bits = 0;
+
+        for (j = 0; j < level_entries.size(); j++) {
+            bits += level_entries[j] * bits_for(exp(scale) * run_entries[j]);
+        }
+
+        if (bits > budget) {
+            low = scale;
+        } else {
+            high = scale;
+        }
+    }
+
+    n = target->num_entries() + incoming;
+
+    if (target->policy == TIERING) {
+        return bits_for(exp(high) * n / (target->runs.size() + 1));
+    } else {
+        return bits_for(exp(high) * n);
     }
+}
+
+/*
+ * Merge the inputs into a new run. Inputs are given newest first,
+ * which determines their precedence.
+ *
+ * Only files whose key ranges overlap are merged: the files of all
+ * inputs are grouped into clusters of overlapping ranges, and a
+ * cluster made of a single file is carried over into the output as
+ * it is. Every other cluster becomes a merge job, and clusters with
+ * at least PARALLEL_MERGE_MIN_ENTRIES entries are split into one job
+ * per merge worker at the files' fence pointers. Jobs write their own
+ * files, which are stitched together in key order at the end.
+ */
+shared_ptr<Run> LSMTree::merge_runs(const vector<shared_ptr<Run>>& inputs,
+                                    bool drop_tombstones, float filter_bits) {
+    vector<pair<int, shared_ptr<RunFile>>> files, cluster;
+    vector<merge_job_t> jobs;
+    vector<KEY_t> fence_keys;
+    shared_ptr<Run> output;
+    merge_job_t job;
+    atomic<int> counter;
+    long cluster_entries;
+    KEY_t cluster_max_key, split_key;
+    int i, j, p, num_merges;
+
+    for (i = 0; i < inputs.size(); i++) {
+        for (auto& file : inputs[i]->files) {
+            files.push_back({i, file});
+        }
+    }
+
+    stable_sort(files.begin(), files.end(),
+                [](const pair<int, shared_ptr<RunFile>>& a,
+                   const pair<int, shared_ptr<RunFile>>& b) {
+                    return a.second->min_key < b.second->min_key;
+                });
 
     /*
-     * Merge all runs in the current level into the first
-     * run in the next level
-     * 经过递归的Merge，断言下一层可以插入至少一个run，这个run就是要生成的新run，通过以下过程进行本层的Merge生成一个新run
-     * 将本层的所有run添加到一个MergeContext对象中，注意run是有时间顺序的，插入顺序决定了优先队列中的排序。
-     * 以读模式打开该层所有run的文件映射
+     * Sweep the files in key order, collecting clusters of
+     * overlapping files.
      */
 
-    for (auto& run : current->runs) {
-        merge_ctx.add(run.map_read(), run.size);
+    num_merges = 0;
+
+    for (i = 0; i < files.size(); i = j) {
+        cluster_max_key = files[i].second->max_key;
+
+        for (j = i + 1; j < files.size() && files[j].second->min_key <= cluster_max_key; j++) {
+            cluster_max_key = max(cluster_max_key, files[j].second->max_key);
+        }
+
+        cluster.assign(files.begin() + i, files.begin() + j);
+
+        job.files.clear();
+        job.start = INT64_MIN;
+        job.end = INT64_MAX;
+        job.reuse = (cluster.size() == 1
+                     && !(drop_tombstones && cluster[0].second->num_tombstones > 0));
+
+        /*
+         * Order the cluster by precedence, so that the MergeContext
+         * releases the newest value of every key.
+         */
+
+        stable_sort(cluster.begin(), cluster.end(),
+                    [](const pair<int, shared_ptr<RunFile>>& a,
+                       const pair<int, shared_ptr<RunFile>>& b) {
+                        return a.first < b.first;
+                    });
+
+        cluster_entries = 0;
+        fence_keys.clear();
+
+        for (auto& file : cluster) {
+            job.files.push_back(file.second);
+            cluster_entries += file.second->size;
+            fence_keys.insert(fence_keys.end(),
+                              file.second->get_fence_pointers().begin(),
+                              file.second->get_fence_pointers().end());
+        }
+
+        if (job.reuse) {
+            jobs.push_back(job);
+            continue;
+        }
+
+        /*
+         * Split large clusters at keys picked evenly from the sorted
+         * fence pointers, so every subrange covers a similar number of
+         * pages. Every key lands in exactly one subrange, so duplicates
+         * across runs are always merged by the same worker.
+         */
+
+        if (cluster_entries >= PARALLEL_MERGE_MIN_ENTRIES && merge_pool.size() > 1) {
+            sort(fence_keys.begin(), fence_keys.end());
+
+            for (p = 1; p < merge_pool.size(); p++) {
+                split_key = fence_keys[p * fence_keys.size() / merge_pool.size()];
+
+                if (job.start < split_key) {
+                    job.end = split_key;
+                    jobs.push_back(job);
+                    num_merges++;
+                    job.start = split_key;
+                }
+            }
+
+            job.end = INT64_MAX;
+        }
+
+        jobs.push_back(job);
+        num_merges++;
     }
 
-    /**
-     * 向next的runs的队头添加一个新的run(越靠前的run越新)
-     */
-    next->runs.emplace_front(next->max_run_size, bf_bits_per_entry);
-    /**
-     * 接下来要开始向这个run写数据了, 以写模式打开刚插入run的文件映射
-     * 注意run.put()是断言文件已经打开, 文件映射有效的
+    /*
+     * Run the merge jobs, on the merge pool if there is more than one
      */
-    next->runs.front().map_write();
 
-    while (!merge_ctx.done()) {
-        entry = merge_ctx.next();
+    counter = 0;
+
+    worker_task merge = [&] {
+        int current_job;
 
-        // Remove deleted keys from the final level
-        if (!(next == levels.end() - 1 && entry.val == VAL_TOMBSTONE)) {
-            next->runs.front().put(entry);
+        while ((current_job = counter++) < jobs.size()) {
+            if (!jobs[current_job].reuse) {
+                run_merge_job(jobs[current_job], drop_tombstones, filter_bits);
+            }
         }
+    };
+
+    if (num_merges > 1 && merge_pool.size() > 1) {
+        merge_pool.run(merge);
+    } else {
+        merge();
     }
 
-    /**
-     * 取消文件映射, 关闭映射文件
+    output = make_shared<Run>(file_config, filter_bits);
+
+    for (auto& job : jobs) {
+        if (job.reuse) {
+            output->add_file(job.files[0]);
+        } else {
+            for (auto& file : job.output->files) {
+                output->add_file(file);
+            }
+        }
+    }
+
+    return output;
+}
+
+/*
+ * Merge the part of the job's files that falls into its key subrange
+ * into a run of new files.
+ */
+void LSMTree::run_merge_job(merge_job_t& job, bool drop_tombstones, float filter_bits) {
+    MergeContext merge_ctx;
+    entry_t block[MERGE_BLOCK_ENTRIES];
+    long begin, end, num_merged, page_entries;
+    int i;
+
+    page_entries = getpagesize() / sizeof(entry_t);
+
+    // Files are read page by page, from the key block and the value
+    // block of each page
+    for (auto& file : job.files) {
+        begin = file->lower_bound(job.start);
+        end = file->lower_bound(job.end);
+        merge_ctx.add(file->page_keys(begin / page_entries), file->page_vals(begin / page_entries),
+                      end - begin, page_entries, 2 * page_entries, begin % page_entries);
+    }
+
+    job.output = make_shared<Run>(file_config, filter_bits);
+
+    while ((num_merged = merge_ctx.next_n(block, MERGE_BLOCK_ENTRIES)) > 0) {
+        for (i = 0; i < num_merged; i++) {
+            if (!(drop_tombstones && block[i].val == VAL_TOMBSTONE)) {
+                job.output->put(block[i]);
+            }
+        }
+    }
+
+    job.output->close();
+}
+
+/*
+ * Merge the current level into the next. Called from a compaction
+ * thread after pick_merge has reserved both levels, so the tree lock
+ * is only taken to snapshot the inputs and to install the result.
+ *
+ * - Into a tiered level, the runs of the current level are merged
+ *   into a new run at the front of the next level. A leveled level
+ *   already holds a single sorted run, which is simply moved.
+ * - Into a leveled level, the runs of both levels are merged into
+ *   the next level's new single run.
+ */
+void LSMTree::merge_down(vector<Level>::iterator current) {
+    vector<shared_ptr<Run>> inputs;
+    vector<Level>::iterator next;
+    shared_ptr<Run> output;
+    long num_current, num_incoming;
+    float filter_bits;
+    bool drop_tombstones;
+
+    assert(current >= levels.begin() && current < levels.end() - 1);
+    next = current + 1;
+
+    /*
+     * Snapshot the runs in the current level, newest first. Runs
+     * flushed into level 0 while the merge is running are newer than
+     * all of the inputs and stay where they are.
      */
-    next->runs.front().unmap();
 
-    for (auto& run : current->runs) {
-        run.unmap();
+    {
+        lock_guard<mutex> guard(levels_lock);
+
+        if (current->policy == LEVELING && next->policy == TIERING) {
+            next->runs.push_front(current->runs.back());
+            current->runs.pop_back();
+            install_version();
+            save_manifest();
+            return;
+        }
+
+        inputs.assign(current->runs.begin(), current->runs.end());
+        num_current = inputs.size();
+        num_incoming = current->num_entries();
+
+        if (next->policy == LEVELING) {
+            inputs.insert(inputs.end(), next->runs.begin(), next->runs.end());
+        }
+
+        /*
+         * Remove deleted keys from the final level, as long as no
+         * older run in it could still hold a value for them.
+         */
+
+        drop_tombstones = (next == levels.end() - 1
+                           && (next->policy == LEVELING || next->runs.empty()));
+
+        filter_bits = filter_bits_per_entry(next, num_incoming);
     }
 
     /*
-     * Clear the current level to delete the old (now
-     * redundant) entry files.
-     * 清空本层的全部run
+     * 将本层的所有run按从新到旧的顺序合并, 键相同时败者树只保留最新run中的值
      */
 
-    current->runs.clear();
+    output = merge_runs(inputs, drop_tombstones, filter_bits);
+
+    /*
+     * Swap the inputs for the merged run. The inputs are the oldest
+     * runs of the current level, and the files are removed once the
+     * last reference to them is dropped.
+     */
+
+    {
+        lock_guard<mutex> guard(levels_lock);
+
+        assert(current->runs.size() >= num_current);
+        assert(current->runs.back() == inputs[num_current - 1]);
+        current->runs.erase(current->runs.end() - num_current, current->runs.end());
+
+        if (next->policy == LEVELING) {
+            assert(next->runs.size() == inputs.size() - num_current);
+            next->runs.clear();
+        }
+
+        next->runs.push_front(output);
+        install_version();
+        save_manifest();
+    }
 }
 
-void LSMTree::put(KEY_t key, VAL_t val) {
+/*
+ * Merge the runs a leveled level has received into a single run that
+ * takes their place at the back of the level.
+ */
+void LSMTree::merge_level(vector<Level>::iterator current) {
+    vector<shared_ptr<Run>> inputs;
+    shared_ptr<Run> output;
+    float filter_bits;
+
+    assert(current->policy == LEVELING);
+
+    {
+        lock_guard<mutex> guard(levels_lock);
+        inputs.assign(current->runs.begin(), current->runs.end());
+        filter_bits = filter_bits_per_entry(current, 0);
+    }
+
+    // The result is the oldest run in the level, so it needs no
+    // tombstones if nothing lies below it
+    output = merge_runs(inputs, current == levels.end() - 1, filter_bits);
+
+    {
+        lock_guard<mutex> guard(levels_lock);
+
+        assert(current->runs.back() == inputs.back());
+        current->runs.erase(current->runs.end() - inputs.size(), current->runs.end());
+        current->runs.push_back(output);
+        install_version();
+        save_manifest();
+    }
+}
+
+void LSMTree::flush_buffer(void) {
+    shared_ptr<Run> run;
+    unique_lock<mutex> guard(levels_lock, defer_lock);
+
     /*
-     * Try inserting the key into the buffer
+     * Write the immutable buffer to a new run. Nothing modifies the
+     * immutable buffer, so this happens without the lock.
+     * 以写模式打开文件映射, 将缓冲区的每个元素都写入到run中，关闭文件映射
      */
 
-    if (buffer.put(key, val)) {
-        return;
+    guard.lock();
+    run = make_shared<Run>(file_config,
+                           filter_bits_per_entry(levels.begin(), immutable_buffer->size()));
+    guard.unlock();
+
+    for (const auto& entry : *immutable_buffer) {
+        run->put(entry);
     }
 
+    run->close();
+
     /*
-     * If the buffer is full, flush level 0 if necessary
-     * to create space
-     * 启动一次merge_down过程, 在L1层留出空间供Buffer写入
+     * Level 0 being full is the hard limit: wait for the compaction
+     * threads to make room. If no merge is running or possible, the
+     * tree is out of space.
      */
 
-    merge_down(levels.begin());
+    guard.lock();
+
+    while (levels.front().remaining() <= 0) {
+        if (merges_in_flight == 0 && pick_merge() == levels.end()) {
+            // Keep the entries in the immutable buffer, and fail puts
+            background_error = Status(STATUS_NO_SPACE, "No more space in tree.");
+            return;
+        }
+
+        levels_changed.wait(guard);
+    }
 
     /*
-     * Flush the buffer to level 0
-     * 在L0队头插入一个新的run（emplace_front()）
-     * levels.front().runs.front指的是L0层的第一个run，就是刚插入的元素。
+     * The entries are now visible through level 0, so lookups
+     * no longer need to consult the immutable buffer.
+     * 在L0队头插入一个新的run
      */
 
-    levels.front().runs.emplace_front(levels.front().max_run_size, bf_bits_per_entry);
+    levels.front().runs.push_front(run);
+    immutable_buffer = nullptr;
+    install_version();
 
-    /**
-     * 以写模式打开文件映射, 将缓冲区的每个元素都写入到run中，关闭文件映射
+    // The run must be in the manifest before its log segments go
+    save_manifest();
+
+    levels_changed.notify_all();
+
+    /*
+     * Log segments before the active buffer's first one only hold
+     * entries that have now reached level 0.
      */
-    levels.front().runs.front().map_write();
 
-    for (const auto& entry : buffer.entries) {
-        levels.front().runs.front().put(entry);
+    if (wal != nullptr) {
+        wal->truncate(buffer_segments[(buffer == buffers[0]) ? 0 : 1]);
+    }
+}
+
+/*
+ * The given active buffer is full. Wait for the previous flush (if
+ * any) to release the other buffer, and for the puts still in the
+ * full one, then swap the full buffer out and hand it to the flush
+ * thread so that puts can carry on in the empty one. Puts that find
+ * the buffer full meanwhile wait here, and then find it swapped.
+ */
+Status LSMTree::swap_buffers(const Buffer *full) {
+    lock_guard<mutex> swap_guard(swap_lock);
+    int active;
+
+    if (buffer.get() != full) return Status();
+
+    if (flush_future.valid()) flush_future.get();
+
+    {
+        lock_guard<mutex> guard(levels_lock);
+        if (!background_error.ok()) return background_error;
+    }
+
+    buffer->seal();
+
+    {
+        lock_guard<mutex> guard(levels_lock);
+
+        immutable_buffer = buffer;
+        active = (buffer == buffers[0]) ? 1 : 0;
+
+        // Readers may still be searching the buffer last flushed
+        if (buffers[active].use_count() > 1) {
+            buffers[active] = make_shared<Buffer>(buffer->max_size);
+        } else {
+            buffers[active]->empty();
+        }
+
+        buffer = buffers[active];
+
+        /*
+         * Entries for the new buffer go to a new log segment, unless
+         * they are being replayed from an old one.
+         */
+
+        if (wal != nullptr) {
+            buffer_segments[active] = replaying ? replay_segment : wal->rotate();
+        }
+
+        install_version();
+    }
+
+    flush_future = flush_pool.enqueue(&LSMTree::flush_buffer, this);
+
+    return Status();
+}
+
+Status LSMTree::put(KEY_t key, VAL_t val) {
+    if (val < VAL_MIN || val > VAL_MAX) {
+        return Status(STATUS_INVALID_ARGUMENT,
+                      "Could not insert value " + to_string(val) + ": out of range.");
     }
 
-    levels.front().runs.front().unmap();
+    return write(key, val);
+}
+
+/*
+ * Insert an entry, tombstones included, into the active buffer. Any
+ * number of threads may write at once.
+ */
+Status LSMTree::write(KEY_t key, VAL_t val) {
+    shared_ptr<const Version> pinned;
+    uint32_t sequence;
+    Status status;
+    entry_t entry;
+
+    // Swap buffers until one takes the entry
+    while (!(pinned = current_version())->buffer->enter()) {
+        if (!(status = swap_buffers(pinned->buffer.get())).ok()) {
+            return status;
+        }
+    }
 
     /*
-     * Empty the buffer and insert the key/value pair
-     * 清空缓冲区，重新插入
+     * Log the entry before it becomes visible in the buffer
      */
 
-    buffer.empty();
-    /**
-     * 这个做法不对, release模式下会出错
-     * TODO: 这里需要修改, 这个out不能放在assert里头, 应当修改为:
-     * auto put_res = buffer.put(key, val);
-     * assert(put_res);
-     */
-    assert(buffer.put(key, val));
+    if (wal != nullptr && !replaying) {
+        entry.key = key;
+        entry.val = val;
+        sequence = log_sequence_base + wal->append(entry);
+    } else {
+        sequence = next_sequence++;
+    }
+
+    pinned->buffer->put(key, val, sequence);
+    pinned->buffer->leave();
+
+    return Status();
 }
 
-Run * LSMTree::get_run(int index) {
+/*
+ * Start logging puts and deletes to the given directory, after
+ * replaying the entries that a previous process logged there but
+ * never flushed to level 0. Segments are removed once their entries
+ * reach level 0, so the runs must be kept in a data directory.
+ */
+Status LSMTree::open_log(string directory, sync_policy_t policy, int interval_ms) {
+    Status status, written;
+
+    assert(wal == nullptr);
+
+    if (!file_config->persistent()) {
+        return Status(STATUS_INVALID_ARGUMENT,
+                      "The write-ahead log needs a data directory for the runs.");
+    }
+
+    wal.reset(new WriteAheadLog(directory, policy, interval_ms));
+
+    if (!(status = wal->open()).ok()) {
+        wal.reset();
+        return status;
+    }
+
+    // Keep every old segment until its entries have been flushed
+    buffer_segments[0] = buffer_segments[1] = 0;
+
+    replaying = true;
+
+    status = wal->replay([&](long segment, entry_t entry) {
+        replay_segment = segment;
+        if (written.ok()) written = write(entry.key, entry.val);
+    });
+
+    replaying = false;
+
+    // Logged writes come after the replayed ones
+    log_sequence_base = next_sequence;
+
+    return status.ok() ? written : status;
+}
+
+/*
+ * Record the files of every run, level by level, in the manifest. The
+ * new manifest is synced and then renamed over the old one, so a
+ * crash leaves either of them intact. Must be called with levels_lock
+ * held, after the files it lists have been sealed and before the
+ * files it no longer lists are removed.
+ */
+void LSMTree::save_manifest(void) {
+    string path, tmp_path;
+    FILE *manifest;
+    int dir_fd;
+
+    if (!file_config->persistent()) return;
+
+    path = file_config->directory + "/" MANIFEST_FILE_NAME;
+    tmp_path = path + ".tmp";
+
+    if ((manifest = fopen(tmp_path.c_str(), "w")) == nullptr) {
+        die("Could not write manifest '" + tmp_path + "'.");
+    }
+
+    fprintf(manifest, MANIFEST_HEADER " %ld\n", (long)levels.size());
+
     for (const auto& level : levels) {
-        if (index < level.runs.size()) {
-            return (Run *) &level.runs[index];
-        } else {
-            index -= level.runs.size();
+        fprintf(manifest, "level %ld\n", (long)level.runs.size());
+
+        for (const auto& run : level.runs) {
+            fprintf(manifest, "run %ld\n", (long)run->files.size());
+
+            for (const auto& file : run->files) {
+                fprintf(manifest, "%s %ld %d %d\n",
+                        file->path.substr(file->path.rfind('/') + 1).c_str(),
+                        file->size, file->min_key, file->max_key);
+            }
+        }
+    }
+
+    if (fflush(manifest) != 0 || fsync(fileno(manifest)) == -1 || fclose(manifest) != 0
+        || rename(tmp_path.c_str(), path.c_str()) == -1) {
+        die("Could not write manifest '" + path + "'.");
+    }
+
+    /*
+     * Sync the directory too, so that the rename and the entries of
+     * new run files survive a crash before log segments are removed
+     */
+
+    if ((dir_fd = open(file_config->directory.c_str(), O_RDONLY | O_DIRECTORY)) == -1
+        || fsync(dir_fd) == -1) {
+        die("Could not sync data directory '" + file_config->directory + "'.");
+    }
+
+    close(dir_fd);
+}
+
+/*
+ * Keep run files in the given directory from now on, after reopening
+ * the levels that a previous process recorded in its manifest there.
+ * Only the footers of the files are read, so this takes about as long
+ * for a large tree as for a small one. Files the manifest does not
+ * list are left over from merges that never finished, and are removed.
+ */
+Status LSMTree::open_directory(string directory) {
+    ifstream manifest;
+    vector<deque<shared_ptr<Run>>> restored;
+    set<string> names;
+    shared_ptr<RunFile> file;
+    Status status;
+    string token, name;
+    DIR *dir;
+    struct dirent *dir_entry;
+    long num_levels, num_runs, num_files, size, number;
+    KEY_t min_key, max_key;
+    char *end;
+    int i;
+
+    assert(!file_config->persistent());
+    assert(buffer->size() == 0 && levels.front().runs.empty());
+
+    if (mkdir(directory.c_str(), 0700) == -1 && errno != EEXIST) {
+        return Status(STATUS_IO_ERROR,
+                      "Could not create data directory '" + directory + "'.");
+    }
+
+    manifest.open(directory + "/" MANIFEST_FILE_NAME);
+
+    if (manifest.is_open()) {
+        if (!(manifest >> token >> num_levels) || token != MANIFEST_HEADER) {
+            return Status(STATUS_CORRUPTION, "Corrupt manifest in '" + directory + "'.");
+        } else if (num_levels > levels.size()) {
+            return Status(STATUS_INVALID_ARGUMENT,
+                          "Tree in '" + directory + "' has " + to_string(num_levels) + " levels.");
+        }
+
+        restored.resize(num_levels);
+
+        for (auto& runs : restored) {
+            if (!(manifest >> token >> num_runs) || token != "level") {
+                return Status(STATUS_CORRUPTION, "Corrupt manifest in '" + directory + "'.");
+            }
+
+            while ((num_runs--) > 0) {
+                if (!(manifest >> token >> num_files) || token != "run") {
+                    return Status(STATUS_CORRUPTION, "Corrupt manifest in '" + directory + "'.");
+                }
+
+                runs.push_back(make_shared<Run>(file_config, 0));
+
+                while ((num_files--) > 0) {
+                    if (!(manifest >> name >> size >> min_key >> max_key)
+                        || !names.insert(name).second) {
+                        return Status(STATUS_CORRUPTION,
+                                      "Corrupt manifest in '" + directory + "'.");
+                    }
+
+                    file = make_shared<RunFile>(directory + "/" + name, *file_config);
+
+                    if (!(status = file->open()).ok()) {
+                        return status;
+                    } else if (file->size != size || file->min_key != min_key
+                               || file->max_key != max_key) {
+                        return Status(STATUS_CORRUPTION,
+                                      "Run file '" + file->path + "' does not match the manifest.");
+                    }
+
+                    runs.back()->add_file(file);
+                }
+            }
+        }
+    }
+
+    /*
+     * Remove unlisted files, and number new files after all the old
+     * ones
+     */
+
+    if ((dir = opendir(directory.c_str())) == nullptr) {
+        return Status(STATUS_IO_ERROR,
+                      "Could not open data directory '" + directory + "'.");
+    }
+
+    while ((dir_entry = readdir(dir)) != nullptr) {
+        name = dir_entry->d_name;
+
+        if (name.size() > sizeof(RUN_FILE_SUFFIX) - 1
+            && name.compare(name.size() - (sizeof(RUN_FILE_SUFFIX) - 1),
+                            string::npos, RUN_FILE_SUFFIX) == 0) {
+            number = strtol(name.c_str(), &end, 10);
+
+            if (*end != '.') {
+                continue;
+            } else if (names.count(name) == 0) {
+                unlink((directory + "/" + name).c_str());
+            } else if (number >= file_config->next_file_number) {
+                file_config->next_file_number = number + 1;
+            }
+        }
+    }
+
+    closedir(dir);
+
+    /*
+     * Install the levels. Reopened levels may be due for a merge.
+     */
+
+    {
+        lock_guard<mutex> guard(levels_lock);
+
+        file_config->directory = directory;
+
+        for (i = 0; i < restored.size(); i++) {
+            levels[i].runs = restored[i];
+
+            // Merges may drop the files from now on
+            for (auto& run : restored[i]) {
+                for (auto& file : run->files) file->keep = false;
+            }
         }
+
+        install_version();
+        save_manifest();
+    }
+
+    levels_changed.notify_all();
+
+    return Status();
+}
+
+/*
+ * Pin the version installed last. Readers hold on to it for as long
+ * as they search it, and flushes and merges go on meanwhile.
+ */
+shared_ptr<const Version> LSMTree::current_version(void) {
+    shared_ptr<const Version> pinned;
+
+    version_lock.lock();
+    pinned = version;
+    version_lock.unlock();
+
+    return pinned;
+}
+
+/*
+ * Install the buffers and levels as they are now as the version that
+ * readers pin. Must be called with levels_lock held, after every
+ * change to them.
+ */
+void LSMTree::install_version(void) {
+    shared_ptr<Version> next;
+    shared_ptr<const Version> previous;
+
+    next = make_shared<Version>();
+    next->buffer = buffer;
+    next->immutable_buffer = immutable_buffer;
+
+    for (const auto& level : levels) {
+        next->levels.emplace_back(level.runs.begin(), level.runs.end());
+    }
+
+    version_lock.lock();
+    previous = version;
+    version = next;
+    version_lock.unlock();
+
+    // Releasing the previous version may remove files, which is kept
+    // out of the spin lock
+    previous.reset();
+}
+
+/*
+ * Look up a key in a run whose filter passed it. Every
+ * LOOKUP_SAMPLE_PERIOD-th lookup of a thread is timed and folded into
+ * lookup_ns. Called by get, and from workers fanned out by it.
+ */
+bool LSMTree::timed_get(Run *run, KEY_t key, uint64_t hash, VAL_t *val) {
+    static thread_local unsigned lookups = 0;
+    chrono::steady_clock::time_point start;
+    int64_t elapsed_ns, average;
+    bool found;
+
+    if (++lookups % LOOKUP_SAMPLE_PERIOD != 0) {
+        return run->get(key, hash, val);
     }
 
-    return nullptr;
-};
+    start = chrono::steady_clock::now();
+    found = run->get(key, hash, val);
+    elapsed_ns = chrono::duration_cast<chrono::nanoseconds>(
+                     chrono::steady_clock::now() - start).count();
+
+    average = lookup_ns.load(memory_order_relaxed);
+    lookup_ns.store(average + (elapsed_ns - average) / (1 << LOOKUP_LATENCY_SHIFT),
+                    memory_order_relaxed);
 
-void LSMTree::get(KEY_t key) {
-    VAL_t *buffer_val;
-    VAL_t latest_val;
-    int latest_run;
+    return found;
+}
+
+/*
+ * Look up a key, returning whether it is in the tree. Runs are
+ * searched inline on the caller's thread, newest first, and only
+ * fanned out to the workers when many runs pass their filters or
+ * lookups have lately been slow, e.g. because they read pages from
+ * disk.
+ */
+bool LSMTree::get(KEY_t key, VAL_t *val) {
+    shared_ptr<const Version> pinned;
+    VAL_t current_val, latest_val;
+    uint64_t hash;
+    bool found;
+    vector<Run *> candidates;
+    Run *run;
+    int64_t average_ns;
+    int latest_run, i;
     SpinLock lock;      // 在这里用了自旋锁
     atomic<int> counter;
 
@@ -196,16 +1068,18 @@ void LSMTree::get(KEY_t key) {
      * 1. 试图从缓冲区中获取数据
      */
 
-    buffer_val = buffer.get(key);
+    pinned = current_version();
+    found = pinned->buffer->get(key, val);
+
+    if (!found && pinned->immutable_buffer != nullptr) {
+        found = pinned->immutable_buffer->get(key, val);
+    }
 
     /**
-     * 1.1 如果数据在缓冲区中, 直接输出就可以, 这里要注意释放返回的value的空间
+     * 1.1 如果数据在缓冲区中, 直接返回就可以
      */
-    if (buffer_val != nullptr) {
-        if (*buffer_val != VAL_TOMBSTONE) cout << *buffer_val;
-        cout << endl;
-        delete buffer_val;
-        return;
+    if (found) {
+        return *val != VAL_TOMBSTONE;
     }
 
     /*
@@ -213,28 +1087,52 @@ void LSMTree::get(KEY_t key) {
      * 2. 在缓冲区里没有找到, 在runs中查找
      */
 
-    counter = 0;
+    // Hashed once for the filters of all runs
+    hash = Filter::hash(key);
+
+    // Only runs whose filters pass the key need their pages read
+    for (i = 0; (run = pinned->get_run(i)) != nullptr; i++) {
+        if (run->may_contain(key, hash)) candidates.push_back(run);
+    }
+
+    /*
+     * Search the candidates inline, newest first, until those left
+     * are expected to take longer than handing them to the workers
+     */
+
     latest_run = -1;
+    average_ns = lookup_ns.load(memory_order_relaxed);
+
+    for (i = 0; i < candidates.size(); i++) {
+        if ((int64_t)(candidates.size() - i) * average_ns > LOOKUP_FAN_OUT_NS) break;
+
+        if (timed_get(candidates[i], key, hash, &current_val)) {
+            latest_run = i;
+            latest_val = current_val;
+            break;
+        }
+    }
+
+    counter = i;
 
     /**
      * 保证了一定是在较新的run中找到的数据
      */
     worker_task search = [&] {
         int current_run;
-        Run *run;
-        VAL_t *current_val;
+        VAL_t current_val;
 
         /**
-         * 3. 获取这个worker要搜索的run的index, 可以用get_run()获取相应的run
+         * 3. 获取这个worker要搜索的run的index
          */
         current_run = counter++;
 
-        if (latest_run >= 0 || (run = get_run(current_run)) == nullptr) {
+        if (latest_run >= 0 || current_run >= candidates.size()) {
             // Stop search if we discovered a key in another run, or
             // if there are no more runs to search
             // 3.1 其他线程已经找到了这个键值对, 或者所有run都已经在搜索了, 就不必继续搜索了
             return;
-        } else if ((current_val = run->get(key)) == nullptr) {
+        } else if (!timed_get(candidates[current_run], key, hash, &current_val)) {
             // Couldn't find the key in the current run, so we need
             // to keep searching.
             // 3.2 在这个run中没有找到, 重新启动search过程
@@ -249,131 +1147,382 @@ void LSMTree::get(KEY_t key) {
             // 只有比本线程更新，才能更新latest_run和latest_val
             if (latest_run < 0 || current_run < latest_run) {
                 latest_run = current_run;
-                latest_val = *current_val;
+                latest_val = current_val;
             }
 
             lock.unlock();
-            delete current_val;
         }
     };
 
     /**
-     * 使用线程池 做数据搜索
+     * 使用线程池 做数据搜索, only for the candidates left
      */
-    worker_pool.launch(search);
-    worker_pool.wait_all();
+    if (latest_run < 0 && i < candidates.size()) {
+        worker_pool.run(search);
+    }
 
-    /**
-     *
-     */
-    if (latest_run >= 0 && latest_val != VAL_TOMBSTONE) {
-        cout << latest_val;
+    if (latest_run < 0 || latest_val == VAL_TOMBSTONE) {
+        return false;
     }
-    cout << endl;
+
+    *val = latest_val;
+    return true;
 }
 
-void LSMTree::range(KEY_t start, KEY_t end) {
-    vector<entry_t> *buffer_range;
-    map<int, vector<entry_t> *> ranges;
-    SpinLock lock;
-    atomic<int> counter;
-    MergeContext merge_ctx;
-    entry_t entry;
+/*
+ * Look up a batch of keys, setting whether each is in the tree and,
+ * if so, its value, at the key's index in the given arrays. Keys
+ * not in the buffers are sorted and split into partitions, and each
+ * worker takes a partition through the runs from newest to oldest,
+ * handing a run all keys still unresolved at once. A run thus reads
+ * each page at most once per partition, and keys stop at the first
+ * run holding them.
+ */
+void LSMTree::multi_get(const vector<KEY_t>& keys, VAL_t *vals, bool *found) {
+    shared_ptr<const Version> pinned;
+    vector<lookup_t> lookups;
+    lookup_t *pending_end;
+    long num_pending, num_partitions, i;
+    atomic<long> counter;
 
-    if (end <= start) {
-        cout << endl;
-        return;
-    } else {
-        // Convert to inclusive bound
-        end -= 1;
-    }
+    for (auto key : keys) lookups.push_back({key, 0, 0, false});
+
+    sort(lookups.begin(), lookups.end(),
+         [](const lookup_t& a, const lookup_t& b) {return a.key < b.key;});
+    lookups.erase(unique(lookups.begin(), lookups.end(),
+                         [](const lookup_t& a, const lookup_t& b) {return a.key == b.key;}),
+                  lookups.end());
 
     /*
-     * Search buffer
+     * Search buffers
      */
 
-    ranges.insert({0, buffer.range(start, end)});
+    pinned = current_version();
+
+    for (auto& lookup : lookups) {
+        lookup.found = pinned->buffer->get(lookup.key, &lookup.val);
+
+        if (!lookup.found && pinned->immutable_buffer != nullptr) {
+            lookup.found = pinned->immutable_buffer->get(lookup.key, &lookup.val);
+        }
+
+        // Hashed once for the filters of all runs
+        lookup.hash = Filter::hash(lookup.key);
+    }
 
     /*
-     * Search runs
-     * 对所有的run都执行range过程...
+     * Search runs, keeping the unresolved keys of a partition sorted
+     * at its front
      */
 
+    pending_end = stable_partition(lookups.data(), lookups.data() + lookups.size(),
+                                   [](const lookup_t& l) {return !l.found;});
+    num_pending = pending_end - lookups.data();
+    num_partitions = min((long)worker_pool.size(),
+                         (num_pending + MULTI_GET_PARTITION_KEYS - 1) / MULTI_GET_PARTITION_KEYS);
     counter = 0;
 
     worker_task search = [&] {
-        int current_run;
+        lookup_t *first, *last;
+        long partition;
         Run *run;
+        int i;
 
-        current_run = counter++;
-
-        if ((run = get_run(current_run)) != nullptr) {
-            lock.lock();
-            // ranges不是线程安全的, 锁insert不就行啦, 都锁了干什么？
-            /**
-             * auto range_res = run->range(start, end);
-             * ranges.insert({current_run + 1, range_res});
-             */
-            ranges.insert({current_run + 1, run->range(start, end)});
-            lock.unlock();
+        while ((partition = counter++) < num_partitions) {
+            first = lookups.data() + partition * num_pending / num_partitions;
+            last = lookups.data() + (partition + 1) * num_pending / num_partitions;
 
-            // Potentially more runs to search.
-            // 一个线程可能需要搜索多个run
-            search();
+            for (i = 0; first != last && (run = pinned->get_run(i)) != nullptr; i++) {
+                run->get(first, last - first);
+                last = stable_partition(first, last, [](const lookup_t& l) {return !l.found;});
+            }
         }
     };
 
-    worker_pool.launch(search);
-    worker_pool.wait_all();
+    if (num_partitions > 0) {
+        worker_pool.run(search);
+    }
 
     /*
-     * Merge ranges and print keys
-     * 在这里利用MergeCtx, 这个想法很好
+     * Hand out results in the order of the keys given
      */
 
-    for (const auto& kv : ranges) {
-        merge_ctx.add(kv.second->data(), kv.second->size());
+    sort(lookups.begin(), lookups.end(),
+         [](const lookup_t& a, const lookup_t& b) {return a.key < b.key;});
+
+    for (i = 0; i < keys.size(); i++) {
+        auto lookup = lower_bound(lookups.begin(), lookups.end(), keys[i],
+                                  [](const lookup_t& l, KEY_t k) {return l.key < k;});
+
+        found[i] = lookup->found && lookup->val != VAL_TOMBSTONE;
+        if (found[i]) vals[i] = lookup->val;
+    }
+}
+
+/*
+ * Open an iterator over the current version. Runs that the range
+ * filters rule out for [lower, upper] are left out, and the iterator
+ * ends past upper. The iterator holds on to the buffers and runs it
+ * reads, so writes, flushes and merges may go on. It reads the active
+ * buffer in place, and so may see puts made after it was opened.
+ */
+unique_ptr<MergingIterator> LSMTree::new_iterator(KEY_t lower, KEY_t upper) {
+    unique_ptr<MergingIterator> iterator(new MergingIterator(upper));
+    shared_ptr<const Version> pinned;
+
+    pinned = current_version();
+
+    iterator->add(unique_ptr<Cursor>(new BufferCursor(pinned->buffer)));
+
+    if (pinned->immutable_buffer != nullptr) {
+        iterator->add(unique_ptr<Cursor>(new BufferCursor(pinned->immutable_buffer)));
     }
 
-    while (!merge_ctx.done()) {
-        entry = merge_ctx.next();
-        if (entry.val != VAL_TOMBSTONE) {
-            cout << entry.key << ":" << entry.val;
-            if (!merge_ctx.done()) cout << " ";
+    for (const auto& runs : pinned->levels) {
+        for (const auto& run : runs) {
+            if (run->may_contain(lower, upper)) {
+                iterator->add(unique_ptr<Cursor>(new RunCursor(run)));
+            }
         }
     }
 
-    cout << endl;
+    return iterator;
+}
 
-    /*
-     * Cleanup subrange vectors
-     * 释放空间
-     */
+/*
+ * Hand the live entries with keys in [start, end) to the callback in
+ * key order, as they stream out of an iterator, until it returns
+ * false
+ */
+void LSMTree::range(KEY_t start, KEY_t end, const function<bool(KEY_t, VAL_t)>& callback) {
+    unique_ptr<MergingIterator> iterator;
+
+    if (end <= start) return;
+
+    // Convert to inclusive bound
+    iterator = new_iterator(start, end - 1);
 
-    for (auto& range : ranges) {
-        delete range.second;
+    for (iterator->seek(start); iterator->valid(); iterator->next()) {
+        if (!callback(iterator->key(), iterator->value())) break;
     }
 }
 
-void LSMTree::del(KEY_t key) {
+/*
+ * Copy the first n live entries with keys in [start, end) into the
+ * given array, returning how many there were
+ */
+long LSMTree::range(KEY_t start, KEY_t end, entry_t *entries, long n) {
+    long num_entries;
+
+    num_entries = 0;
+
+    if (n == 0) return 0;
+
+    range(start, end, [&](KEY_t key, VAL_t val) {
+        entries[num_entries].key = key;
+        entries[num_entries].val = val;
+        return ++num_entries < n;
+    });
+
+    return num_entries;
+}
+
+Status LSMTree::del(KEY_t key) {
     // put一个坟墓标志
-    put(key, VAL_TOMBSTONE);
+    return write(key, VAL_TOMBSTONE);
 }
 
-void LSMTree::load(string file_path) {
-    ifstream stream;
-    entry_t entry;
+/*
+ * Build runs straight from the entries of a load, when they can go
+ * into a level above everything already in the tree. The entries are
+ * copied and sorted in chunks across the merge workers, keeping the
+ * last write of every key in a chunk, and the chunks are then merged
+ * (later chunks first) into runs for the deepest level with room for
+ * all of them. Returns false, having changed nothing, if the buffers
+ * hold entries or no level fits.
+ */
+bool LSMTree::bulk_load(entry_t *entries, long num_entries) {
+    vector<vector<entry_t>> chunks;
+    vector<shared_ptr<Run>> runs;
+    vector<Level>::iterator target;
+    MergeContext merge_ctx;
+    entry_t block[MERGE_BLOCK_ENTRIES];
+    atomic<int> counter;
+    long run_max_size, num_merged;
+    float filter_bits;
+    bool drop_tombstones;
+    int i;
 
-    /**
-     * 打开LSM-Tree文件, 利用put()方法加载所有键值对
+    // Let the immutable buffer reach level 0, and keep the buffers
+    // from being swapped until the runs are in place
+    lock_guard<mutex> swap_guard(swap_lock);
+
+    if (flush_future.valid()) flush_future.get();
+
+    if (current_version()->buffer->size() > 0) return false;
+
+    /*
+     * Find the shallowest level holding runs, then the deepest level
+     * at or above it that can take all the entries
      */
-    stream.open(file_path, ifstream::binary);
 
-    if (stream.is_open()) {
-        while (stream >> entry) {
-            put(entry.key, entry.val);
+    {
+        lock_guard<mutex> guard(levels_lock);
+
+        for (target = levels.begin(); target < levels.end() - 1; target++) {
+            if (!target->runs.empty()) break;
         }
+
+        drop_tombstones = target->runs.empty();
+
+        while (true) {
+            if (target->policy == TIERING
+                && target->remaining() * target->max_run_size >= num_entries) {
+                break;
+            } else if (target->policy == LEVELING
+                       && target->capacity() - target->num_entries() >= num_entries) {
+                break;
+            } else if (target == levels.begin()) {
+                return false;
+            }
+
+            target--;
+        }
+
+        filter_bits = filter_bits_per_entry(target, num_entries);
+    }
+
+    /*
+     * Sort and dedupe the chunks
+     */
+
+    chunks.resize((num_entries + BULK_LOAD_CHUNK_ENTRIES - 1) / BULK_LOAD_CHUNK_ENTRIES);
+    counter = 0;
+
+    worker_task sort_chunks = [&] {
+        int current_chunk;
+        long begin, end, j, k;
+
+        while ((current_chunk = counter++) < chunks.size()) {
+            vector<entry_t>& chunk = chunks[current_chunk];
+
+            begin = current_chunk * BULK_LOAD_CHUNK_ENTRIES;
+            end = min(begin + BULK_LOAD_CHUNK_ENTRIES, num_entries);
+
+            chunk.assign(entries + begin, entries + end);
+            stable_sort(chunk.begin(), chunk.end());
+
+            for (j = 0, k = 0; j < chunk.size(); j++) {
+                if (j + 1 == chunk.size() || chunk[j + 1].key != chunk[j].key) {
+                    chunk[k++] = chunk[j];
+                }
+            }
+
+            chunk.resize(k);
+        }
+    };
+
+    if (chunks.size() > 1 && merge_pool.size() > 1) {
+        merge_pool.run(sort_chunks);
     } else {
-        die("Could not locate file '" + file_path + "'.");
+        sort_chunks();
+    }
+
+    /*
+     * Merge the chunks into runs. A tiered level gets runs of at most
+     * max_run_size entries, which cover disjoint key ranges.
+     */
+
+    // The entries of a chunk are key, value pairs: blocks of one
+    for (i = chunks.size() - 1; i >= 0; i--) {
+        merge_ctx.add(&chunks[i].data()->key, &chunks[i].data()->val, chunks[i].size(),
+                      1, sizeof(entry_t) / sizeof(KEY_t));
     }
+
+    run_max_size = (target->policy == TIERING) ? target->max_run_size : num_entries;
+
+    while ((num_merged = merge_ctx.next_n(block, MERGE_BLOCK_ENTRIES)) > 0) {
+        for (i = 0; i < num_merged; i++) {
+            if (drop_tombstones && block[i].val == VAL_TOMBSTONE) {
+                continue;
+            } else if (runs.empty() || runs.back()->size == run_max_size) {
+                if (!runs.empty()) runs.back()->close();
+                runs.push_back(make_shared<Run>(file_config, filter_bits));
+            }
+
+            runs.back()->put(block[i]);
+        }
+    }
+
+    if (!runs.empty()) runs.back()->close();
+
+    {
+        lock_guard<mutex> guard(levels_lock);
+
+        for (auto& run : runs) {
+            target->runs.push_front(run);
+        }
+
+        install_version();
+        save_manifest();
+    }
+
+    levels_changed.notify_all();
+
+    return true;
+}
+
+/*
+ * Load a binary file of entries, as if they were put in order. The
+ * file is mapped rather than read, and bulk loaded when possible.
+ */
+Status LSMTree::load(string file_path) {
+    struct stat file_stat;
+    entry_t *entries;
+    Status status;
+    long num_entries, i;
+    int fd;
+
+    if ((fd = open(file_path.c_str(), O_RDONLY)) == -1) {
+        return Status(STATUS_IO_ERROR, "Could not locate file '" + file_path + "'.");
+    } else if (fstat(fd, &file_stat) == -1) {
+        close(fd);
+        return Status(STATUS_IO_ERROR, "Could not locate file '" + file_path + "'.");
+    }
+
+    num_entries = file_stat.st_size / sizeof(entry_t);
+
+    if (num_entries == 0) {
+        close(fd);
+        return status;
+    }
+
+    entries = (entry_t *)mmap(0, num_entries * sizeof(entry_t), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (entries == MAP_FAILED) {
+        return Status(STATUS_IO_ERROR, "Could not map file '" + file_path + "'.");
+    }
+
+    if (!bulk_load(entries, num_entries)) {
+        for (i = 0; i < num_entries && status.ok(); i++) {
+            status = write(entries[i].key, entries[i].val);
+        }
+    }
+
+    munmap(entries, num_entries * sizeof(entry_t));
+
+    return status;
+}
+
+/*
+ * Block cache lookups so far that found their page, and that did not,
+ * both zero without a cache
+ */
+long LSMTree::cache_hits(void) const {
+    return (file_config->block_cache != nullptr) ? file_config->block_cache->hits() : 0;
+}
+
+long LSMTree::cache_misses(void) const {
+    return (file_config->block_cache != nullptr) ? file_config->block_cache->misses() : 0;
 }
@@ -1,34 +1,139 @@
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
 #include <vector>
 
 #include "buffer.h"
+#include "iterator.h"
 #include "level.h"
 #include "spin_lock.h"
+#include "status.h"
 #include "types.h"
+#include "version.h"
+#include "wal.h"
 #include "worker_pool.h"
 
 #define DEFAULT_TREE_DEPTH 5
 #define DEFAULT_TREE_FANOUT 10
 #define DEFAULT_BUFFER_NUM_PAGES 1000
 #define DEFAULT_THREAD_COUNT 4
+#define DEFAULT_CLIENT_THREAD_COUNT 1
+#define DEFAULT_COMPACTION_THREAD_COUNT 1
 #define DEFAULT_BF_BITS_PER_ENTRY 0.5
+#define DEFAULT_MERGE_POLICY "tiering"
+#define DEFAULT_RUN_FILE_NUM_PAGES 256
+#define DEFAULT_SYNC_POLICY "always"
+#define DEFAULT_BLOCK_CACHE_MB 64
+#define DEFAULT_FENCE_LAYOUT "eytzinger"
+#define DEFAULT_FILTER_FAMILY "bloom"
+#define DEFAULT_RANGE_FILTER_BITS_PER_ENTRY 0
+#define PARALLEL_MERGE_MIN_ENTRIES (1 << 16)
+#define MULTI_GET_PARTITION_KEYS 256
+// Roughly what handing a lookup to the workers and waiting on them
+// costs. Gets search inline until the runs left would take longer.
+#define LOOKUP_FAN_OUT_NS 20000
+// A timed lookup moves the average 1/2^shift of the way, and one in
+// every so many lookups of a thread is timed
+#define LOOKUP_LATENCY_SHIFT 3
+#define LOOKUP_SAMPLE_PERIOD 16
+#define BULK_LOAD_CHUNK_ENTRIES (1 << 22)
+#define MANIFEST_FILE_NAME "MANIFEST"
+#define MANIFEST_HEADER "lsm-manifest-1"
+
+/*
+ * Part of a merge handled by one worker: the entries of the input
+ * files (newest first) that fall into the key subrange [start, end).
+ * A job that reuses its single input file does no merging at all.
+ */
+struct merge_job {
+    vector<shared_ptr<RunFile>> files;
+    int64_t start, end;
+    bool reuse;
+    shared_ptr<Run> output;
+};
+
+typedef struct merge_job merge_job_t;
 
 class LSMTree {
-    // C0
-    Buffer buffer;
+    // C0: puts go to the active buffer while the immutable one (if
+    // any) is flushed to level 0 in the background
+    shared_ptr<Buffer> buffers[2];
+    shared_ptr<Buffer> buffer, immutable_buffer;
+    // Puts that find the active buffer full swap buffers one at a time
+    mutex swap_lock;
+    // Orders writes to the same key in a buffer. Logged writes take
+    // their number in the log, counted on from log_sequence_base.
+    atomic<uint32_t> next_sequence;
+    uint32_t log_sequence_base;
+    // Guards the levels and the immutable buffer pointer
+    mutex levels_lock;
+    // What readers search, swapped whenever the levels change
+    shared_ptr<const Version> version;
+    SpinLock version_lock;
+    // Signalled whenever a flush or merge changes the levels
+    condition_variable levels_changed;
+    ThreadPool flush_pool;
+    future<void> flush_future;
+    // Optional write-ahead log, and the first log segment holding
+    // entries of each buffer
+    unique_ptr<WriteAheadLog> wal;
+    long buffer_segments[2];
+    bool replaying;
+    long replay_segment;
+    // Set by a flush that found no room, and returned by later puts
+    Status background_error;
+    // Background merges
+    vector<thread> compaction_threads;
+    int merges_in_flight;
+    bool shutting_down;
     // 线程池
     WorkerPool worker_pool;
+    // Merges get their own workers so that lookups never queue
+    // behind a partition of a large merge
+    WorkerPool merge_pool;
+    // Moving average of the time a run takes to look up a key that
+    // passed its filter. Racing updates may drop a sample.
+    atomic<int64_t> lookup_ns;
+    // Average bloom filter bits per entry over the whole tree
     float bf_bits_per_entry;
+    bool last_level_filters;
+    // Size and location of run files, shared with every run
+    shared_ptr<RunFileConfig> file_config;
     // 多个 Level
     vector<Level> levels;
-    // 获取相应位置的run
-    Run * get_run(int);
+    bool timed_get(Run *, KEY_t, uint64_t, VAL_t *);
     // rolling merge
+    vector<Level>::iterator pick_merge(void);
+    float filter_bits_per_entry(vector<Level>::iterator, long);
+    shared_ptr<Run> merge_runs(const vector<shared_ptr<Run>>&, bool, float);
+    void run_merge_job(merge_job_t&, bool, float);
     void merge_down(vector<Level>::iterator);
+    void merge_level(vector<Level>::iterator);
+    void compaction_loop(void);
+    shared_ptr<const Version> current_version(void);
+    void install_version(void);
+    Status swap_buffers(const Buffer *);
+    Status write(KEY_t, VAL_t);
+    void flush_buffer(void);
+    void save_manifest(void);
+    bool bulk_load(entry_t *, long);
 public:
-    LSMTree(int, int, int, int, float);
-    void put(KEY_t, VAL_t);
-    void get(KEY_t);
-    void range(KEY_t, KEY_t);
-    void del(KEY_t);
-    void load(std::string);
+    LSMTree(int, int, int, int, int, float, bool, const vector<merge_policy_t>&, long,
+            fence_layout_t, filter_family_t, float, size_t);
+    ~LSMTree(void);
+    Status put(KEY_t, VAL_t);
+    bool get(KEY_t, VAL_t *);
+    void multi_get(const vector<KEY_t>&, VAL_t *, bool *);
+    void range(KEY_t, KEY_t, const function<bool(KEY_t, VAL_t)>&);
+    long range(KEY_t, KEY_t, entry_t *, long);
+    unique_ptr<MergingIterator> new_iterator(KEY_t = KEY_MIN, KEY_t = KEY_MAX);
+    Status del(KEY_t);
+    Status load(std::string);
+    Status open_directory(string);
+    Status open_log(string, sync_policy_t, int);
+    long cache_hits(void) const;
+    long cache_misses(void) const;
 };
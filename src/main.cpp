@@ -1,64 +1,313 @@
+#include <atomic>
+#include <cctype>
 #include <iostream>
+#include <sstream>
+#include <thread>
 
 #include "lsm_tree.h"
 #include "sys.h"
 #include "unistd.h"
 
 using namespace std;
-// console
-void command_loop(LSMTree& tree) {
+// Library errors end the program
+void check(Status status) {
+    if (!status.ok()) die(status.message);
+}
+
+/*
+ * A get, multi-get or range query, and its answer
+ */
+struct read_command {
     char command;
     KEY_t key_a, key_b;
+    vector<KEY_t> keys;
+    string output;
+};
+
+void answer(LSMTree& tree, read_command& read) {
+    ostringstream out;
+    VAL_t val;
+    bool first;
+
+    switch (read.command) {
+    case 'g':
+        if (tree.get(read.key_a, &val)) out << val;
+        out << '\n';
+        break;
+    case 'm':
+        {
+            unique_ptr<bool[]> found(new bool[read.keys.size()]);
+            vector<VAL_t> vals(read.keys.size());
+
+            tree.multi_get(read.keys, vals.data(), found.get());
+
+            for (size_t i = 0; i < read.keys.size(); i++) {
+                if (found[i]) out << vals[i];
+                out << '\n';
+            }
+        }
+
+        break;
+    case 'r':
+        first = true;
+
+        tree.range(read.key_a, read.key_b, [&](KEY_t key, VAL_t val) {
+            if (!first) out << " ";
+            out << key << ":" << val;
+            first = false;
+            return true;
+        });
+
+        out << '\n';
+        break;
+    }
+
+    read.output = out.str();
+}
+
+/*
+ * Answer a run of reads on the given number of client threads at
+ * once, and print the answers in order
+ */
+void answer_all(LSMTree& tree, vector<read_command>& reads, int num_clients) {
+    vector<thread> clients;
+    atomic<size_t> counter(0);
+
+    auto client = [&] {
+        size_t i;
+        while ((i = counter++) < reads.size()) answer(tree, reads[i]);
+    };
+
+    while ((int)clients.size() < min(num_clients, (int)reads.size()) - 1) {
+        clients.emplace_back(client);
+    }
+
+    client();
+
+    for (auto& c : clients) c.join();
+
+    for (const auto& read : reads) cout << read.output;
+    cout.flush();
+
+    reads.clear();
+}
+
+/*
+ * A put or a delete
+ */
+struct write_command {
+    char command;
+    KEY_t key;
     VAL_t val;
-    string file_path;
+};
+
+/*
+ * Apply a run of writes on the given number of client threads at
+ * once. All writes to a key go to the same thread, in order, so the
+ * last write to each key still wins.
+ */
+void apply_all(LSMTree& tree, vector<write_command>& writes, int num_clients) {
+    vector<thread> clients;
+    int num_threads, i;
+
+    num_threads = min(num_clients, (int)writes.size());
+
+    auto client = [&](int index) {
+        for (const auto& write : writes) {
+            if ((uint32_t)write.key % num_threads != index) continue;
+
+            if (write.command == 'p') {
+                check(tree.put(write.key, write.val));
+            } else {
+                check(tree.del(write.key));
+            }
+        }
+    };
+
+    for (i = 1; i < num_threads; i++) {
+        clients.emplace_back(client, i);
+    }
+
+    if (num_threads > 0) client(0);
+
+    for (auto& c : clients) c.join();
+
+    writes.clear();
+}
+
+/*
+ * Whether another command has already arrived. Blank space is skipped
+ * first, so the end of the last line read does not count.
+ */
+bool input_pending(void) {
+    while (cin.rdbuf()->in_avail() > 0) {
+        if (!isspace(cin.peek())) return true;
+        cin.get();
+    }
+
+    return false;
+}
+
+// console
+void command_loop(LSMTree& tree, int num_clients) {
+    char command;
+    KEY_t key_a;
+    VAL_t val;
+    string file_path, line;
+    vector<read_command> reads;
+    vector<write_command> writes;
+    read_command read;
 
     while (cin >> command) {
+        // Reads and writes gather into runs of their own, so that the
+        // commands of a run can go side by side
+        if (command != 'g' && command != 'm' && command != 'r') {
+            answer_all(tree, reads, num_clients);
+        }
+
+        if (command != 'p' && command != 'd') {
+            apply_all(tree, writes, num_clients);
+        }
+
         switch (command) {
         case 'p':
             cin >> key_a >> val;
+            writes.push_back({command, key_a, val});
+            break;
+        case 'g':
+            read.command = command;
+            cin >> read.key_a;
+            reads.push_back(read);
+            break;
+        case 'm':
+            read.command = command;
+            // Keys to look up, up to the end of the line
+            getline(cin, line);
+            read.keys.clear();
 
-            if (val < VAL_MIN || val > VAL_MAX) {
-                die("Could not insert value " + to_string(val) + ": out of range.");
-            } else {
-                tree.put(key_a, val);
+            for (istringstream stream(line); stream >> key_a;) {
+                read.keys.push_back(key_a);
             }
 
-            break;
-        case 'g':
-            cin >> key_a;
-            tree.get(key_a);
+            reads.push_back(read);
+            read.keys.clear();
             break;
         case 'r':
-            cin >> key_a >> key_b;
-            tree.range(key_a, key_b);
+            read.command = command;
+            cin >> read.key_a >> read.key_b;
+            reads.push_back(read);
             break;
         case 'd':
             cin >> key_a;
-            tree.del(key_a);
+            writes.push_back({command, key_a, 0});
+            break;
+        case 's':
+            cout << "Block cache hits: " << tree.cache_hits()
+                 << ", misses: " << tree.cache_misses() << endl;
             break;
         case 'l':
             cin.ignore();
             getline(cin, file_path);
             // Trim quotes
-            tree.load(file_path.substr(1, file_path.size() - 2));
+            check(tree.load(file_path.substr(1, file_path.size() - 2)));
             break;
         default:
             die("Invalid command.");
         }
+
+        // Only hold commands back while more are waiting
+        if (num_clients == 1 || !input_pending()) {
+            answer_all(tree, reads, num_clients);
+            apply_all(tree, writes, num_clients);
+        }
+    }
+
+    answer_all(tree, reads, num_clients);
+    apply_all(tree, writes, num_clients);
+}
+
+/*
+ * Parse a merge policy: "tiering", "leveling", "lazy-leveling" (tiered
+ * levels above a leveled last level), or one letter per level, e.g.
+ * "ttl". Per-level lists shorter than the tree repeat their last
+ * letter.
+ */
+vector<merge_policy_t> parse_merge_policies(string policy, int depth) {
+    vector<merge_policy_t> merge_policies;
+
+    if (policy == "tiering") {
+        merge_policies.push_back(TIERING);
+    } else if (policy == "leveling") {
+        merge_policies.push_back(LEVELING);
+    } else if (policy == "lazy-leveling") {
+        merge_policies.assign(max(depth - 1, 0), TIERING);
+        merge_policies.push_back(LEVELING);
+    } else {
+        for (auto c : policy) {
+            if (c == 't') {
+                merge_policies.push_back(TIERING);
+            } else if (c == 'l') {
+                merge_policies.push_back(LEVELING);
+            } else {
+                die("Invalid merge policy '" + policy + "'.");
+            }
+        }
+
+        if (merge_policies.empty()) die("Invalid merge policy '" + policy + "'.");
+    }
+
+    return merge_policies;
+}
+
+fence_layout_t parse_fence_layout(string layout) {
+    if (layout == "binary") {
+        return FENCE_BINARY;
+    } else if (layout == "eytzinger") {
+        return FENCE_EYTZINGER;
+    } else if (layout == "learned") {
+        return FENCE_LEARNED;
     }
+
+    die("Invalid fence pointer layout '" + layout + "'.");
+    return FENCE_BINARY;
+}
+
+filter_family_t parse_filter_family(string family) {
+    if (family == "bloom") {
+        return FILTER_BLOOM;
+    } else if (family == "fuse") {
+        return FILTER_FUSE;
+    }
+
+    die("Invalid filter type '" + family + "'.");
+    return FILTER_BLOOM;
 }
 
 int main(int argc, char *argv[]) {
-    int opt, buffer_num_pages, buffer_max_entries, depth, fanout, num_threads;
-    float bf_bits_per_entry;
+    int opt, buffer_num_pages, buffer_max_entries, depth, fanout, num_threads, num_clients,
+        num_compaction_threads, file_num_pages, block_cache_mb;
+    float bf_bits_per_entry, range_filter_bits;
+    bool last_level_filters;
+    string merge_policy, data_directory, wal_directory, sync_policy, fence_layout,
+           filter_family;
 
     buffer_num_pages = DEFAULT_BUFFER_NUM_PAGES;
     depth = DEFAULT_TREE_DEPTH;
     fanout = DEFAULT_TREE_FANOUT;
     num_threads = DEFAULT_THREAD_COUNT;
+    num_clients = DEFAULT_CLIENT_THREAD_COUNT;
+    num_compaction_threads = DEFAULT_COMPACTION_THREAD_COUNT;
     bf_bits_per_entry = DEFAULT_BF_BITS_PER_ENTRY;
+    last_level_filters = true;
+    merge_policy = DEFAULT_MERGE_POLICY;
+    file_num_pages = DEFAULT_RUN_FILE_NUM_PAGES;
+    sync_policy = DEFAULT_SYNC_POLICY;
+    block_cache_mb = DEFAULT_BLOCK_CACHE_MB;
+    fence_layout = DEFAULT_FENCE_LAYOUT;
+    filter_family = DEFAULT_FILTER_FAMILY;
+    range_filter_bits = DEFAULT_RANGE_FILTER_BITS_PER_ENTRY;
 
-    while ((opt = getopt(argc, argv, "b:d:f:t:r:")) != -1) {
+    while ((opt = getopt(argc, argv, "b:d:f:t:j:c:r:nx:q:m:s:i:k:p:w:y:")) != -1) {
         switch (opt) {
         case 'b':
             buffer_num_pages = atoi(optarg);
@@ -72,23 +321,97 @@ int main(int argc, char *argv[]) {
         case 't':
             num_threads = atoi(optarg);
             break;
+        case 'j':
+            num_clients = max(atoi(optarg), 1);
+            break;
+        case 'c':
+            num_compaction_threads = atoi(optarg);
+            break;
         case 'r':
             bf_bits_per_entry = atof(optarg);
             break;
+        case 'n':
+            last_level_filters = false;
+            break;
+        case 'x':
+            filter_family = optarg;
+            break;
+        case 'q':
+            range_filter_bits = atof(optarg);
+            break;
+        case 'm':
+            merge_policy = optarg;
+            break;
+        case 's':
+            file_num_pages = atoi(optarg);
+            break;
+        case 'i':
+            fence_layout = optarg;
+            break;
+        case 'k':
+            block_cache_mb = atoi(optarg);
+            break;
+        case 'p':
+            data_directory = optarg;
+            break;
+        case 'w':
+            wal_directory = optarg;
+            break;
+        case 'y':
+            sync_policy = optarg;
+            break;
         default:
             die("Usage: " + string(argv[0]) + " "
                 "[-b number of pages in buffer] "
                 "[-d number of levels] "
                 "[-f level fanout] "
                 "[-t number of threads] "
-                "[-r bloom filter bits per entry] "
+                "[-j number of client threads for runs of reads or writes] "
+                "[-c number of compaction threads] "
+                "[-r bloom filter bits per entry, averaged over the tree] "
+                "[-n no filters on the last level] "
+                "[-x filter type: bloom or fuse] "
+                "[-q range filter bits per entry, 0 for none] "
+                "[-m merge policy: tiering, leveling, lazy-leveling or one of t/l per level] "
+                "[-s number of pages in a run file] "
+                "[-i fence pointer layout: binary, eytzinger or learned] "
+                "[-k block cache size in MB, 0 to disable] "
+                "[-p data directory for run files and the manifest] "
+                "[-w write-ahead log directory, needs -p] "
+                "[-y log sync policy: always, none or an interval in ms] "
                 "<[workload]");
         }
     }
 
     buffer_max_entries = buffer_num_pages * getpagesize() / sizeof(entry_t);
-    LSMTree tree(buffer_max_entries, depth, fanout, num_threads, bf_bits_per_entry);
-    command_loop(tree);
+    LSMTree tree(buffer_max_entries, depth, fanout, num_threads,
+                 num_compaction_threads, bf_bits_per_entry, last_level_filters,
+                 parse_merge_policies(merge_policy, depth),
+                 (long)file_num_pages * getpagesize() / sizeof(entry_t),
+                 parse_fence_layout(fence_layout),
+                 parse_filter_family(filter_family), range_filter_bits,
+                 (size_t)block_cache_mb << 20);
+
+    if (!data_directory.empty()) {
+        check(tree.open_directory(data_directory));
+    }
+
+    if (!wal_directory.empty()) {
+        if (sync_policy == "always") {
+            check(tree.open_log(wal_directory, SYNC_ALWAYS, 0));
+        } else if (sync_policy == "none") {
+            check(tree.open_log(wal_directory, SYNC_NONE, 0));
+        } else if (atoi(sync_policy.c_str()) > 0) {
+            check(tree.open_log(wal_directory, SYNC_INTERVAL, atoi(sync_policy.c_str())));
+        } else {
+            die("Invalid log sync policy '" + sync_policy + "'.");
+        }
+    }
+
+    // Give cin its own buffer, so input_pending can look ahead
+    ios::sync_with_stdio(false);
+
+    command_loop(tree, num_clients);
 
     return 0;
 }
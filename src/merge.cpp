@@ -3,41 +3,108 @@
 
 #include "merge.h"
 
-void MergeContext::add(entry_t *entries, long num_entries) {
+/*
+ * Add a sorted input of the given number of entries. Inputs split
+ * into blocks give the entries per block, the distance from one block
+ * to the next, and where in its block the first entry is; by default,
+ * an input is a single block.
+ */
+void MergeContext::add(const KEY_t *keys, const VAL_t *vals, long num_entries,
+                       long block_entries, long stride, long position) {
     merge_entry_t merge_entry;
 
+    assert(!built);
+
     if (num_entries > 0) {
-        merge_entry.entries = entries;
-        merge_entry.num_entries = num_entries;
-        merge_entry.precedence = queue.size();
-        queue.push(merge_entry);
+        merge_entry.keys = keys;
+        merge_entry.vals = vals;
+        merge_entry.block_entries = block_entries;
+        merge_entry.stride = stride;
+        merge_entry.position = position;
+        merge_entry.remaining = num_entries;
+        merge_entry.precedence = cursors.size();
+        merge_entry.update_order();
+        cursors.push_back(merge_entry);
+    }
+}
+
+/*
+ * Play the matches in the subtree rooted at the given node, storing
+ * the loser of each match and returning the winner. Leaves sit at
+ * indices k..2k-1, so the tree works for any number of cursors.
+ */
+int MergeContext::build(int node) {
+    int left, right;
+
+    if (node >= cursors.size()) {
+        return node - cursors.size();
+    }
+
+    left = build(2 * node);
+    right = build(2 * node + 1);
+
+    if (cursors[left].order < cursors[right].order) {
+        losers[node] = right;
+        return left;
+    } else {
+        losers[node] = left;
+        return right;
+    }
+}
+
+void MergeContext::advance_winner(void) {
+    int node, challenger;
+
+    cursors[winner].advance();
+    cursors[winner].update_order();
+
+    // Replay the matches on the path from the winner's leaf to the root
+    for (node = (winner + cursors.size()) / 2; node > 0; node /= 2) {
+        challenger = losers[node];
+
+        if (cursors[challenger].order < cursors[winner].order) {
+            losers[node] = winner;
+            winner = challenger;
+        }
     }
 }
 
 entry_t MergeContext::next(void) {
-    merge_entry_t current, next;
     entry_t entry;
 
-    current = queue.top();
-    next = current;
+    assert(!done());
+
+    entry = cursors[winner].head();
+    advance_winner();
 
     // Only release the most recent value for a given key
-    while (next.head().key == current.head().key && !queue.empty()) {
-        // 先pop出来, 因为存的是元素，不是指针, 因此要采用这种方法
-        queue.pop();
+    while (!cursors[winner].done() && cursors[winner].head_key() == entry.key) {
+        advance_winner();
+    }
+
+    return entry;
+}
 
-        // 修改next.current, 因为当前位置的元素将要被添加到合并后的run中
-        next.current_index++;
-        // 如果序列中还有元素, 再push进去
-        if (!next.done()) queue.push(next);
+/*
+ * Fill the output block with up to n merged entries, returning how
+ * many were written.
+ */
+long MergeContext::next_n(entry_t *output, long n) {
+    long i;
 
-        // 重新比较, 获取优先级最高的元素.
-        next = queue.top();
+    for (i = 0; i < n && !done(); i++) {
+        output[i] = next();
     }
 
-    return current.head();
+    return i;
 }
 
 bool MergeContext::done(void) {
-    return queue.empty();
+    if (!built) {
+        losers.assign(cursors.size(), 0);
+        winner = cursors.empty() ? 0 : build(1);
+        built = true;
+    }
+
+    return cursors.empty() || cursors[winner].done();
 }
@@ -1,43 +1,69 @@
 #include <cassert>
-#include <queue>
+#include <climits>
+#include <cstdint>
+#include <vector>
 
 #include "types.h"
 
+#define MERGE_BLOCK_ENTRIES 512
+
 using namespace std;
 
 /**
- * 可以看做 一个 run 的迭代器
+ * 可以看做 一个 run 的迭代器. The keys and values come in blocks, such
+ * as the pages of a run file, where block b starts stride elements
+ * after block b - 1 for both.
  */
 struct merge_entry {
     int precedence;         // 优先级, 优先权
-    entry_t *entries;       // 键值对数据
-    long num_entries;       // 键值对长度
-    int current_index = 0;  // 当前位置
-    entry_t head(void) const {return entries[current_index];}
-    bool done(void) const {return current_index == num_entries;}
+    const KEY_t *keys;      // 当前块的键
+    const VAL_t *vals;      // 当前块的值
+    long block_entries;     // 每块的键值对数量
+    long stride;
+    long position;          // 当前块中的位置
+    long remaining;         // 剩余的键值对数量
     /**
-     * 比较函数: 首先: 为 head()方法的返回值，即entries[current_index]
-     * 当head()方法返回值相同时, 按precedence排序
-     * @param other
-     * @return
+     * Key and precedence of the head entry packed into one integer,
+     * so a single comparison orders two cursors. Exhausted cursors
+     * sort after everything else.
      */
-    bool operator>(const merge_entry& other) const {
-        // Order first by keys, then by precedence
-        if (head() == other.head()) {
-            assert(precedence != other.precedence);
-            return precedence > other.precedence;
-        } else {
-            return head() > other.head();
+    int64_t order;
+    KEY_t head_key(void) const {return keys[position];}
+    entry_t head(void) const {return {keys[position], vals[position]};}
+    bool done(void) const {return remaining == 0;}
+    void advance(void) {
+        remaining--;
+        if (++position == block_entries) {
+            keys += stride;
+            vals += stride;
+            position = 0;
         }
     }
+    void update_order(void) {
+        order = done() ? INT64_MAX : (int64_t)head_key() * ((int64_t)1 << 32) + precedence;
+    }
 };
 
 typedef struct merge_entry merge_entry_t;
 
+/*
+ * K-way merge over sorted runs using a tournament (loser) tree. Each
+ * inner node remembers the cursor that lost the match played there,
+ * so advancing the winner only replays the matches on its path to
+ * the root: about log2(k) comparisons per entry. Runs added earlier
+ * take precedence, and only their value is released for a key.
+ */
 class MergeContext {
-    priority_queue<merge_entry_t, vector<merge_entry_t>, greater<merge_entry_t>> queue;
+    vector<merge_entry_t> cursors;
+    vector<int> losers;
+    int winner;
+    bool built;
+    int build(int);
+    void advance_winner(void);
 public:
-    void add(entry_t *, long);
+    MergeContext(void) : winner(0), built(false) {}
+    void add(const KEY_t *, const VAL_t *, long, long = LONG_MAX, long = 0, long = 0);
     entry_t next(void);
+    long next_n(entry_t *, long);
     bool done(void);
 };
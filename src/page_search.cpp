@@ -0,0 +1,85 @@
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PAGE_SEARCH_X86
+#endif
+
+#include "page_search.h"
+
+/*
+ * Narrow [0, n) down to at most window entries that hold the key if
+ * the page does, returning the first of them. The comparison turns
+ * into a conditional move rather than a branch.
+ */
+static inline long narrow(const KEY_t *keys, long n, KEY_t key, long window, long *length) {
+    long base, half;
+
+    base = 0;
+
+    while (n > window) {
+        half = n / 2;
+        base = (keys[base + half] <= key) ? base + half : base;
+        n -= half;
+    }
+
+    *length = n;
+    return base;
+}
+
+static long page_search_scalar(const KEY_t *keys, long n, KEY_t key) {
+    long base, length;
+
+    if (n == 0) return -1;
+
+    base = narrow(keys, n, key, 1, &length);
+
+    return keys[base] == key ? base : -1;
+}
+
+#ifdef PAGE_SEARCH_X86
+/*
+ * Compare a window of 32 keys, eight per register
+ */
+__attribute__((target("avx2")))
+static long page_search_avx2(const KEY_t *keys, long n, KEY_t key) {
+    const __m256i *window;
+    __m256i needle;
+    uint32_t mask;
+    long base, length;
+    int i;
+
+    if (n < PAGE_SEARCH_WINDOW) return page_search_scalar(keys, n, key);
+
+    base = narrow(keys, n, key, PAGE_SEARCH_WINDOW, &length);
+    // Keep the whole window on the page
+    base = base + PAGE_SEARCH_WINDOW > n ? n - PAGE_SEARCH_WINDOW : base;
+    window = (const __m256i *)(keys + base);
+    needle = _mm256_set1_epi32(key);
+    mask = 0;
+
+    for (i = 0; i < PAGE_SEARCH_WINDOW / 8; i++) {
+        mask |= (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(
+                    _mm256_cmpeq_epi32(_mm256_loadu_si256(window + i), needle))) << (8 * i);
+    }
+
+    return mask == 0 ? -1 : base + __builtin_ctz(mask);
+}
+#endif
+
+typedef long (*page_search_kernel)(const KEY_t *, long, KEY_t);
+
+static page_search_kernel select_kernel(void) {
+#ifdef PAGE_SEARCH_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return page_search_avx2;
+#endif
+    return page_search_scalar;
+}
+
+// Picked once, when the program starts
+static const page_search_kernel kernel = select_kernel();
+
+long page_search(const KEY_t *keys, long n, KEY_t key) {
+    return kernel(keys, n, key);
+}
@@ -0,0 +1,18 @@
+#ifndef PAGE_SEARCH_H
+#define PAGE_SEARCH_H
+
+#include "types.h"
+
+// Keys the vector kernel compares at once, after binary search has
+// narrowed the page down to them
+#define PAGE_SEARCH_WINDOW 32
+
+/*
+ * Find a key in the sorted keys of a page, returning its index or -1.
+ * A branchless binary search narrows the page down to a window, which
+ * is then compared in one go with AVX2 if the CPU running us has it,
+ * or else narrowed down to a single entry.
+ */
+long page_search(const KEY_t *, long, KEY_t);
+
+#endif
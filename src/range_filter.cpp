@@ -0,0 +1,54 @@
+#include <algorithm>
+
+#include "bloom_filter.h"
+#include "range_filter.h"
+
+/*
+ * Flip the sign bit so that prefixes of the unsigned key sort like
+ * the signed keys
+ */
+static inline uint32_t ordered(KEY_t key) {
+    return (uint32_t)key ^ 0x80000000U;
+}
+
+RangeFilter::RangeFilter(long max_entries, float bits_per_entry) :
+             filter(new BloomFilter(max_entries * bits_per_entry,
+                                    max(BloomFilter::optimal_hashes(bits_per_entry
+                                                                    / RANGE_FILTER_LEVELS), 1))) {}
+
+uint64_t RangeFilter::hash(int shift, uint32_t prefix) {
+    return Filter::mix((uint64_t)shift << 32 | prefix);
+}
+
+void RangeFilter::set(KEY_t key) {
+    int shift;
+
+    for (shift = 0; shift <= RANGE_FILTER_MAX_SHIFT; shift += RANGE_FILTER_SHIFT_STEP) {
+        filter->set(hash(shift, ordered(key) >> shift));
+    }
+}
+
+/*
+ * Check the inclusive range [start, end]
+ */
+bool RangeFilter::may_contain(KEY_t start, KEY_t end) const {
+    uint32_t first, last;
+    // Wider than a prefix, so the loop ends when last is 0xFFFFFFFF
+    uint64_t prefix;
+    int shift;
+
+    for (shift = 0; shift <= RANGE_FILTER_MAX_SHIFT; shift += RANGE_FILTER_SHIFT_STEP) {
+        first = ordered(start) >> shift;
+        last = ordered(end) >> shift;
+
+        if (last - first >= RANGE_FILTER_MAX_PROBES) continue;
+
+        for (prefix = first; prefix <= last; prefix++) {
+            if (filter->is_set(hash(shift, prefix))) return true;
+        }
+
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,38 @@
+#ifndef RANGE_FILTER_H
+#define RANGE_FILTER_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "filter.h"
+#include "types.h"
+
+// Prefixes are taken every RANGE_FILTER_SHIFT_STEP bits, from the
+// whole key up to RANGE_FILTER_MAX_SHIFT low bits dropped
+#define RANGE_FILTER_SHIFT_STEP 4
+#define RANGE_FILTER_MAX_SHIFT 24
+#define RANGE_FILTER_LEVELS (RANGE_FILTER_MAX_SHIFT / RANGE_FILTER_SHIFT_STEP + 1)
+#define RANGE_FILTER_MAX_PROBES 8
+
+using namespace std;
+
+/*
+ * Prefix Bloom filter answering whether a file may hold any key in a
+ * range. Every key is added once per prefix length, and a range is
+ * checked at the shortest prefix length that covers it with at most
+ * RANGE_FILTER_MAX_PROBES prefixes. Ranges too wide for that are
+ * always let through.
+ */
+class RangeFilter {
+    unique_ptr<Filter> filter;
+    static uint64_t hash(int, uint32_t);
+public:
+    RangeFilter(long, float);
+    RangeFilter(const char *data, size_t length) : filter(Filter::load(data, length)) {}
+    void set(KEY_t);
+    bool may_contain(KEY_t, KEY_t) const;
+    void save(string& data) const {filter->save(data);}
+};
+
+#endif
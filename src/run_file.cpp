@@ -0,0 +1,395 @@
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "page_search.h"
+#include "run_file.h"
+#include "sys.h"
+
+using namespace std;
+
+string RunFileConfig::new_file_path(void) {
+    char *tmp_fn, name[32];
+    string path;
+
+    if (!persistent()) {
+        // 对临时文件命名，后面几个X，就加多少随机后缀
+        tmp_fn = strdup(TMP_FILE_PATTERN);
+        path = mktemp(tmp_fn);
+        free(tmp_fn);
+        return path;
+    }
+
+    snprintf(name, sizeof(name), "%06ld" RUN_FILE_SUFFIX, next_file_number++);
+    return directory + "/" + name;
+}
+
+atomic<uint64_t> RunFile::next_id(0);
+
+RunFile::RunFile(RunFileConfig& config, float bf_bits_per_entry) :
+         filter(Filter::create(config.filter_family, bf_bits_per_entry)),
+         fence_pointers(config.fence_layout),
+         id(next_id++),
+         block_cache(config.block_cache),
+         max_size(config.max_size),
+         path(config.new_file_path()),
+         keep(false)
+{
+    if (config.range_filter_bits > 0) {
+        range_filter.reset(new RangeFilter(config.max_size, config.range_filter_bits));
+    }
+
+    size = 0;
+    min_key = KEY_MAX;
+    max_key = KEY_MIN;
+    num_tombstones = 0;
+    // 更改vector的容量（capacity），使vector至少可以容纳n个元素
+    fence_pointers.reserve(max_size / (getpagesize() / sizeof(entry_t)) + 1);
+
+    mapping = nullptr;
+    mapping_fd = -1;
+}
+
+/*
+ * A sealed file to be reopened from its footer with open. It is kept
+ * on disk until the tree has installed it.
+ */
+RunFile::RunFile(string path, const RunFileConfig& config) :
+         fence_pointers(config.fence_layout),
+         id(next_id++), block_cache(config.block_cache),
+         path(path), keep(true)
+{
+    mapping = nullptr;
+    mapping_fd = -1;
+}
+
+Status RunFile::open(void) {
+    run_file_footer_t footer;
+    vector<KEY_t> fence_keys;
+    string filter_data, range_filter_data;
+    struct stat file_stat;
+    off_t offset;
+    int fd;
+
+    assert(mapping == nullptr);
+
+    auto corrupt = [&](string message) {
+        close(fd);
+        return Status(STATUS_CORRUPTION, message);
+    };
+
+    if ((fd = ::open(path.c_str(), O_RDONLY)) == -1) {
+        return Status(STATUS_IO_ERROR, "Could not open run file '" + path + "'.");
+    } else if (fstat(fd, &file_stat) == -1) {
+        close(fd);
+        return Status(STATUS_IO_ERROR, "Could not open run file '" + path + "'.");
+    }
+
+    offset = file_stat.st_size - (off_t)sizeof(run_file_footer_t);
+
+    if (offset < 0
+        || pread(fd, &footer, sizeof(footer), offset) != sizeof(footer)
+        || (footer.magic & RUN_FILE_MAGIC_MASK) != RUN_FILE_MAGIC) {
+        return corrupt("Corrupt run file '" + path + "'.");
+    } else if (footer.magic >> 56 != '0' + RUN_FILE_VERSION) {
+        return corrupt("Run file '" + path + "' has an unsupported format version.");
+    }
+
+    size = footer.size;
+    max_size = footer.max_size;
+
+    if (offset != (off_t)(pages_size()
+                             + footer.num_fence_pointers * sizeof(KEY_t)
+                             + footer.filter_size
+                             + footer.range_filter_size)) {
+        return corrupt("Corrupt run file '" + path + "'.");
+    }
+
+    num_tombstones = footer.num_tombstones;
+    min_key = footer.min_key;
+    max_key = footer.max_key;
+
+    fence_keys.resize(footer.num_fence_pointers);
+    filter_data.resize(footer.filter_size);
+    range_filter_data.resize(footer.range_filter_size);
+
+    offset = pages_size();
+
+    if (pread(fd, fence_keys.data(), fence_keys.size() * sizeof(KEY_t), offset)
+        != fence_keys.size() * sizeof(KEY_t)) {
+        return corrupt("Corrupt run file '" + path + "'.");
+    }
+
+    offset += fence_keys.size() * sizeof(KEY_t);
+
+    if (pread(fd, &filter_data[0], filter_data.size(), offset) != filter_data.size()) {
+        return corrupt("Corrupt run file '" + path + "'.");
+    }
+
+    offset += filter_data.size();
+
+    if (pread(fd, &range_filter_data[0], range_filter_data.size(), offset)
+        != range_filter_data.size()) {
+        return corrupt("Corrupt run file '" + path + "'.");
+    }
+
+    filter.reset(Filter::load(filter_data.data(), filter_data.size()));
+
+    if (!range_filter_data.empty()) {
+        range_filter.reset(new RangeFilter(range_filter_data.data(),
+                                           range_filter_data.size()));
+    }
+
+    fence_pointers.assign(fence_keys.data(), fence_keys.size());
+    fence_pointers.build();
+
+    mapping_length = pages_size();
+    mapping = (char *)mmap(0, mapping_length, PROT_READ, MAP_SHARED, fd, 0);
+
+    // The mapping keeps the file referenced
+    close(fd);
+
+    if (mapping == MAP_FAILED) {
+        mapping = nullptr;
+        return Status(STATUS_IO_ERROR, "Could not map run file '" + path + "'.");
+    }
+
+    return Status();
+}
+
+RunFile::~RunFile(void) {
+    assert(mapping_fd == -1);
+    if (mapping != nullptr) munmap(mapping, mapping_length);
+    // 删除文件
+    if (!keep) remove(path.c_str());
+}
+
+void RunFile::map_write(void) {
+    assert(mapping == nullptr);
+    int result;
+
+    mapping_length = pages_size();
+
+    mapping_fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    assert(mapping_fd != -1);
+
+    // Set the file to the appropriate length
+    result = lseek(mapping_fd, mapping_length - 1, SEEK_SET);
+    assert(result != -1);
+    result = write(mapping_fd, "", 1);
+    assert(result != -1);
+
+    mapping = (char *)mmap(0, mapping_length, PROT_WRITE, MAP_SHARED, mapping_fd, 0);
+    assert(mapping != MAP_FAILED);
+}
+
+/*
+ * Finish writing the file: append the footer after the entries,
+ * optionally waiting for all of it to reach the disk. The mapping
+ * stays, read-only, until the file goes away, so lookups never map
+ * or open the file again.
+ */
+void RunFile::seal(bool sync) {
+    run_file_footer_t footer;
+    string trailer;
+    size_t filter_end;
+
+    assert(mapping_fd != -1);
+
+    filter->build();
+
+    footer.magic = RUN_FILE_MAGIC | (uint64_t)('0' + RUN_FILE_VERSION) << 56;
+    footer.size = size;
+    footer.max_size = max_size;
+    footer.num_tombstones = num_tombstones;
+    footer.num_fence_pointers = fence_pointers.size();
+    footer.min_key = min_key;
+    footer.max_key = max_key;
+
+    trailer.append((char *)fence_pointers.get_keys().data(),
+                   fence_pointers.size() * sizeof(KEY_t));
+    filter->save(trailer);
+    footer.filter_size = trailer.size() - fence_pointers.size() * sizeof(KEY_t);
+    filter_end = trailer.size();
+    if (range_filter != nullptr) range_filter->save(trailer);
+    footer.range_filter_size = trailer.size() - filter_end;
+    trailer.append((char *)&footer, sizeof(footer));
+
+    if (pwrite(mapping_fd, trailer.data(), trailer.size(), mapping_length) != trailer.size()
+        || (sync && fdatasync(mapping_fd) == -1)) {
+        die("Could not write run file '" + path + "'.");
+    }
+
+    fence_pointers.build();
+
+    if (mprotect(mapping, mapping_length, PROT_READ) == -1) {
+        die("Could not map run file '" + path + "'.");
+    }
+
+    close(mapping_fd);
+    mapping_fd = -1;
+}
+
+/*
+ * Return a page, from the block cache if there is one. Cache hits stay
+ * pinned through the given pointer until it is reset, misses are read
+ * from the mapping and added to the cache.
+ */
+run_page_t RunFile::read_page(long page_index, pinned_page_t& pinned, bool scan) const {
+    const char *data;
+    run_page_t page;
+
+    data = (const char *)page_keys(page_index);
+
+    if (block_cache == nullptr) {
+        // Read in place
+    } else if ((pinned = block_cache->get(id, page_index)) != nullptr) {
+        data = pinned->data();
+    } else {
+        block_cache->insert(id, page_index, data, scan);
+    }
+
+    page.keys = (const KEY_t *)data;
+    page.vals = (const VAL_t *)(page.keys + getpagesize() / sizeof(entry_t));
+    page.size = page_entries(page_index);
+
+    return page;
+}
+
+bool RunFile::get(KEY_t key, uint64_t hash, VAL_t *val) {
+    pinned_page_t pinned;
+    long page_index, i;
+    run_page_t page;
+
+    /**
+     * 有点像B+树的查找，如果比当前run最小的还小, 比最大的还大
+     * 或者filter中返回false(对于一个偏是的算法, 返回false一定不在)
+     */
+    if (key < min_key || key > max_key || !filter->is_set(hash)) {
+        return false;
+    }
+
+    /**
+     * 找到第一个大于key的KEY的迭代器，并计算得到key可能存在的页的位置 page_index
+     */
+    page_index = fence_pointers.find(key);
+    assert(page_index >= 0);
+
+    page = read_page(page_index, pinned, false);
+
+    /**
+     * 在页内查找键, and only read the value of a match
+     */
+    if ((i = page_search(page.keys, page.size, key)) < 0) {
+        return false;
+    }
+
+    *val = page.vals[i];
+    return true;
+}
+
+/*
+ * Look up a sorted batch of keys. Keys on the same page share one
+ * read of it.
+ */
+void RunFile::get(lookup_t *lookups, long n) {
+    long page_index, last_page_index, i, j;
+    pinned_page_t pinned;
+    run_page_t page;
+
+    last_page_index = -1;
+    page.size = 0;
+
+    for (i = 0; i < n; i++) {
+        if (lookups[i].key < min_key || lookups[i].key > max_key
+            || !filter->is_set(lookups[i].hash)) {
+            continue;
+        }
+
+        page_index = fence_pointers.find(lookups[i].key);
+        assert(page_index >= 0);
+
+        if (page_index != last_page_index) {
+            page = read_page(page_index, pinned, false);
+            last_page_index = page_index;
+        }
+
+        if ((j = page_search(page.keys, page.size, lookups[i].key)) >= 0) {
+            lookups[i].found = true;
+            lookups[i].val = page.vals[j];
+        }
+    }
+}
+
+/*
+ * Whether the file may hold keys in the inclusive range [start, end]
+ */
+bool RunFile::may_contain(KEY_t start, KEY_t end) const {
+    if (start > max_key || min_key > end) {
+        return false;
+    } else if (range_filter == nullptr) {
+        return true;
+    }
+
+    // Keys outside the file's bounds need no probes
+    return range_filter->may_contain(max(start, min_key), min(end, max_key));
+}
+
+/*
+ * Index of the first entry whose key is not below the given one
+ */
+long RunFile::lower_bound(int64_t key) const {
+    long page_index;
+    const KEY_t *keys;
+
+    if (key <= min_key) {
+        return 0;
+    } else if (key > max_key) {
+        return size;
+    }
+
+    page_index = max(fence_pointers.find(key), (long)0);
+    keys = page_keys(page_index);
+
+    return page_index * (getpagesize() / sizeof(entry_t))
+           + (std::lower_bound(keys, keys + page_entries(page_index), (KEY_t)key) - keys);
+}
+
+void RunFile::put(entry_t entry) {
+    long page_index, offset;
+
+    /**
+     * 断言文件可写，mapping不为空
+     * put的顺序必须是key有序的
+     */
+    assert(size < max_size);
+
+    filter->set(Filter::hash(entry.key));
+    if (range_filter != nullptr) range_filter->set(entry.key);
+
+    if (entry.val == VAL_TOMBSTONE) {
+        num_tombstones++;
+    }
+
+    page_index = size / (getpagesize() / sizeof(entry_t));
+    offset = size % (getpagesize() / sizeof(entry_t));
+
+    if (offset == 0) {
+        //
+        fence_pointers.push_back(entry.key);
+    }
+
+    min_key = min(entry.key, min_key);
+    max_key = max(entry.key, max_key);
+
+    // The key goes to the page's key block, the value to its value block
+    page_keys(page_index)[offset] = entry.key;
+    page_vals(page_index)[offset] = entry.val;
+    size++;
+}
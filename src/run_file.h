@@ -0,0 +1,164 @@
+#ifndef RUN_FILE_H
+#define RUN_FILE_H
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include "types.h"
+#include "block_cache.h"
+#include "filter.h"
+#include "fence_index.h"
+#include "range_filter.h"
+#include "status.h"
+
+#define TMP_FILE_PATTERN "/tmp/lsm-XXXXXX"
+#define RUN_FILE_SUFFIX ".run"
+// "MLSFILE" followed by the format version as one digit
+#define RUN_FILE_MAGIC 0x00454c4946534c4dULL
+#define RUN_FILE_MAGIC_MASK 0x00ffffffffffffffULL
+#define RUN_FILE_VERSION 5
+
+using namespace std;
+
+/*
+ * Where the files of a tree live and how large they are. Without a
+ * directory, files are temporary and go away with the tree; with one,
+ * files are numbered and outlive the process.
+ */
+class RunFileConfig {
+public:
+    long max_size;
+    string directory;
+    atomic<long> next_file_number;
+    // Optional cache for the pages lookups read
+    shared_ptr<BlockCache> block_cache;
+    fence_layout_t fence_layout;
+    filter_family_t filter_family;
+    // Range filter bits per entry, 0 for no range filters
+    float range_filter_bits;
+    RunFileConfig(long m, fence_layout_t f, filter_family_t ff, float r) :
+                  max_size(m), next_file_number(0), fence_layout(f),
+                  filter_family(ff), range_filter_bits(r) {}
+    bool persistent(void) const {return !directory.empty();}
+    string new_file_path(void);
+};
+
+/*
+ * Trailer of a sealed file. The fence pointers, the saved filter and
+ * the saved range filter, if any, are stored right before it, after
+ * the pages.
+ */
+struct run_file_footer {
+    uint64_t magic;
+    int64_t size, max_size, num_tombstones;
+    int64_t num_fence_pointers, filter_size, range_filter_size;
+    KEY_t min_key, max_key;
+};
+
+typedef struct run_file_footer run_file_footer_t;
+
+/*
+ * A page of a file holds the keys of up to a page's worth of entries,
+ * followed by their values, so key searches never read the values.
+ */
+struct run_page {
+    const KEY_t *keys;
+    const VAL_t *vals;
+    long size;
+};
+
+typedef struct run_page run_page_t;
+
+/*
+ * One key of a batched lookup, with its filter hash. Batches are
+ * sorted by key, and lookups set found and val for the keys they
+ * find.
+ */
+struct lookup {
+    KEY_t key;
+    VAL_t val;
+    uint64_t hash;
+    bool found;
+};
+
+typedef struct lookup lookup_t;
+
+/*
+ * One file of a run. A file holds up to max_size entries sorted by
+ * key, and has its own filter and fence pointers. The files of a
+ * run cover disjoint key ranges, so a merge can keep any file whose
+ * range does not overlap the other inputs. A finished file is sealed
+ * with a footer holding all of this, so it can be reopened later
+ * without reading its entries.
+ */
+class RunFile {
+    // 一个RunFile 包含 Filter,
+    unique_ptr<Filter> filter;
+    // Optional, lets range queries skip the file
+    unique_ptr<RangeFilter> range_filter;
+    // 索引所有写入的Key
+    FenceIndex fence_pointers;
+    // 文件映射: writable until the file is sealed, then read-only
+    char *mapping;
+    size_t mapping_length;
+    int mapping_fd;
+    // Identifies the file's pages in the block cache
+    static atomic<uint64_t> next_id;
+    uint64_t id;
+    shared_ptr<BlockCache> block_cache;
+    // Bytes taken by the pages, the last of which may not be full
+    size_t pages_size(void) const {
+        return (max_size + getpagesize() / sizeof(entry_t) - 1)
+               / (getpagesize() / sizeof(entry_t)) * getpagesize();
+    }
+public:
+    long size, max_size;
+    // 最小和最大的key
+    KEY_t min_key, max_key;
+    long num_tombstones;
+    string path;
+    // Set to leave the file on disk when the object goes away
+    bool keep;
+    RunFile(RunFileConfig&, float);
+    RunFile(string, const RunFileConfig&);
+    ~RunFile(void);
+    Status open(void);
+
+    // 以下几个methods用于文件映射管理
+    void map_write(void);
+
+    void seal(bool);
+
+    bool get(KEY_t, uint64_t, VAL_t *);
+    void get(lookup_t *, long);
+    bool may_contain(KEY_t, KEY_t) const;
+    bool may_contain(KEY_t key, uint64_t hash) const {
+        return min_key <= key && key <= max_key && filter->is_set(hash);
+    }
+    void put(entry_t);
+    bool full(void) const {return size == max_size;}
+    // The pages of a file, mapped for as long as it lives. Merges
+    // read them here, past the block cache.
+    KEY_t * page_keys(long page_index) const {
+        return (KEY_t *)(mapping + page_index * getpagesize());
+    }
+    VAL_t * page_vals(long page_index) const {
+        return (VAL_t *)(page_keys(page_index) + getpagesize() / sizeof(entry_t));
+    }
+    long lower_bound(int64_t) const;
+    const vector<KEY_t>& get_fence_pointers(void) const {return fence_pointers.get_keys();}
+    // Page by page reads, for scans
+    long num_pages(void) const {return fence_pointers.size();}
+    long find_page(KEY_t key) const {return fence_pointers.find(key);}
+    long page_entries(long page_index) const {
+        return min((long)(getpagesize() / sizeof(entry_t)),
+                   size - page_index * (long)(getpagesize() / sizeof(entry_t)));
+    }
+    run_page_t read_page(long, pinned_page_t&, bool) const;
+};
+
+#endif
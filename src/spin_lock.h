@@ -1,3 +1,6 @@
+#ifndef SPIN_LOCK_H
+#define SPIN_LOCK_H
+
 #include <atomic>
 
 using namespace std;
@@ -14,3 +17,5 @@ public:
         flag.clear(memory_order_release);
     }
 };
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef STATUS_H
+#define STATUS_H
+
+#include <string>
+
+using namespace std;
+
+enum status_code {
+    STATUS_OK,
+    STATUS_INVALID_ARGUMENT,
+    STATUS_IO_ERROR,
+    STATUS_CORRUPTION,
+    STATUS_NO_SPACE
+};
+
+typedef enum status_code status_code_t;
+
+/*
+ * Outcome of a call into the tree, with a message saying what went
+ * wrong if anything did. Errors the tree cannot recover from, such
+ * as failing to allocate memory, still end the process.
+ */
+class Status {
+public:
+    status_code_t code;
+    string message;
+    Status(void) : code(STATUS_OK) {}
+    Status(status_code_t c, string m) : code(c), message(m) {}
+    bool ok(void) const {return code == STATUS_OK;}
+};
+
+#endif
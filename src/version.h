@@ -0,0 +1,36 @@
+#ifndef VERSION_H
+#define VERSION_H
+
+#include <memory>
+#include <vector>
+
+#include "buffer.h"
+#include "run.h"
+
+/*
+ * The buffers and runs that make up the tree at one point in time. A
+ * version never changes once installed: flushes and merges install a
+ * new one, and readers search the version they pinned without taking
+ * the tree lock. Runs, and the files behind them, are removed once
+ * the last version holding them is released.
+ */
+class Version {
+public:
+    shared_ptr<Buffer> buffer, immutable_buffer;
+    // The runs of every level, newest first
+    vector<vector<shared_ptr<Run>>> levels;
+    // 获取相应位置的run
+    Run * get_run(int index) const {
+        for (const auto& runs : levels) {
+            if (index < runs.size()) {
+                return runs[index].get();
+            } else {
+                index -= runs.size();
+            }
+        }
+
+        return nullptr;
+    }
+};
+
+#endif
@@ -0,0 +1,290 @@
+#include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "sys.h"
+#include "wal.h"
+
+using namespace std;
+
+/*
+ * FNV-1a over the entry, so that a torn or never-synced tail is not
+ * mistaken for entries on replay
+ */
+static uint32_t record_checksum(entry_t entry) {
+    const unsigned char *bytes;
+    uint32_t hash;
+    int i;
+
+    bytes = (const unsigned char *)&entry;
+    hash = 2166136261u;
+
+    for (i = 0; i < sizeof(entry_t); i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+
+    return hash;
+}
+
+WriteAheadLog::WriteAheadLog(string directory, sync_policy_t policy, int interval_ms) :
+                             directory(directory), policy(policy),
+                             interval_ms(interval_ms), fd(-1),
+                             appended(0), synced(0),
+                             writing(false), stopping(false) {}
+
+/*
+ * Pick up the segments left behind by a previous process, and start
+ * a new one
+ */
+Status WriteAheadLog::open(void) {
+    DIR *dir;
+    struct dirent *dir_entry;
+    string name;
+    char *end;
+    long segment;
+
+    if (mkdir(directory.c_str(), 0700) == -1 && errno != EEXIST) {
+        return Status(STATUS_IO_ERROR, "Could not create log directory '" + directory + "'.");
+    }
+
+    if ((dir = opendir(directory.c_str())) == nullptr) {
+        return Status(STATUS_IO_ERROR, "Could not open log directory '" + directory + "'.");
+    }
+
+    while ((dir_entry = readdir(dir)) != nullptr) {
+        name = dir_entry->d_name;
+
+        if (name.size() > sizeof(WAL_FILE_SUFFIX) - 1
+            && name.compare(name.size() - (sizeof(WAL_FILE_SUFFIX) - 1),
+                            string::npos, WAL_FILE_SUFFIX) == 0) {
+            segment = strtol(name.c_str(), &end, 10);
+            if (*end == '.') segments.insert(segment);
+        }
+    }
+
+    closedir(dir);
+
+    // Never append to an old segment, its tail may be torn
+    segment = segments.empty() ? 0 : *segments.rbegin() + 1;
+
+    if (!open_segment(segment)) {
+        return Status(STATUS_IO_ERROR,
+                      "Could not open log segment '" + segment_path(segment) + "'.");
+    }
+
+    if (policy == SYNC_INTERVAL) {
+        sync_thread = thread(&WriteAheadLog::sync_loop, this);
+    }
+
+    return Status();
+}
+
+WriteAheadLog::~WriteAheadLog(void) {
+    unique_lock<mutex> guard(lock);
+
+    stopping = true;
+    write_pending(guard, policy != SYNC_NONE);
+    guard.unlock();
+
+    written.notify_all();
+    if (sync_thread.joinable()) sync_thread.join();
+
+    if (fd != -1) close(fd);
+}
+
+string WriteAheadLog::segment_path(long segment) const {
+    char name[32];
+
+    snprintf(name, sizeof(name), "%06ld" WAL_FILE_SUFFIX, segment);
+    return directory + "/" + name;
+}
+
+bool WriteAheadLog::open_segment(long segment) {
+    if (fd != -1) close(fd);
+
+    fd = ::open(segment_path(segment).c_str(), O_WRONLY | O_CREAT | O_APPEND, 0600);
+
+    if (fd == -1 || !sync_directory()) return false;
+
+    segments.insert(segment);
+    return true;
+}
+
+/*
+ * Sync the log directory, so that segments created or removed survive
+ * a crash. Otherwise a synced append could sit in a segment the
+ * directory no longer lists, or a removed segment could come back.
+ */
+bool WriteAheadLog::sync_directory(void) const {
+    int dir_fd;
+    bool synced;
+
+    if ((dir_fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY)) == -1) return false;
+
+    synced = fsync(dir_fd) == 0;
+    close(dir_fd);
+
+    return synced;
+}
+
+/*
+ * Feed every intact entry of the old segments to the callback, oldest
+ * first, along with the segment it came from.
+ */
+Status WriteAheadLog::replay(function<void(long, entry_t)> callback) {
+    vector<long> old_segments;
+    wal_record_t record;
+    FILE *file;
+
+    /*
+     * Flushes of the replayed entries truncate the log meanwhile, so
+     * take the list of old segments up front
+     */
+
+    {
+        lock_guard<mutex> guard(lock);
+
+        for (auto segment : segments) {
+            if (segment != current_segment()) old_segments.push_back(segment);
+        }
+    }
+
+    for (auto segment : old_segments) {
+        if ((file = fopen(segment_path(segment).c_str(), "rb")) == nullptr) {
+            return Status(STATUS_IO_ERROR,
+                          "Could not read log segment '" + segment_path(segment) + "'.");
+        }
+
+        while (fread(&record, sizeof(wal_record_t), 1, file) == 1
+               && record.checksum == record_checksum(record.entry)) {
+            callback(segment, record.entry);
+        }
+
+        fclose(file);
+    }
+
+    return Status();
+}
+
+/*
+ * Hand the pending records to the file in a single write. Only one
+ * thread writes at a time, and appends arriving meanwhile pile up in
+ * pending for the next write: this is what batches concurrent writers
+ * into a single fdatasync.
+ */
+void WriteAheadLog::write_pending(unique_lock<mutex>& guard, bool sync) {
+    long last;
+    int write_fd;
+    ssize_t result;
+
+    while (writing) {
+        written.wait(guard);
+    }
+
+    writing = true;
+    batch.swap(pending);
+    last = appended;
+    write_fd = fd;
+    sync = sync && last > synced;
+
+    guard.unlock();
+
+    if (!batch.empty()) {
+        result = write(write_fd, batch.data(), batch.size() * sizeof(wal_record_t));
+        if (result != batch.size() * sizeof(wal_record_t)) die("Could not write to log.");
+    }
+
+    if (sync && fdatasync(write_fd) == -1) {
+        die("Could not sync log.");
+    }
+
+    guard.lock();
+
+    batch.clear();
+    if (sync) synced = last;
+    writing = false;
+
+    written.notify_all();
+}
+
+/*
+ * Append an entry, returning its number in the log. Numbers follow
+ * the order of the records in the log, also among concurrent appends.
+ */
+long WriteAheadLog::append(entry_t entry) {
+    unique_lock<mutex> guard(lock);
+    wal_record_t record;
+    long sequence;
+
+    record.entry = entry;
+    record.checksum = record_checksum(entry);
+
+    pending.push_back(record);
+    sequence = ++appended;
+
+    if (policy == SYNC_ALWAYS) {
+        // Either lead the next group commit or wait for one to cover us
+        while (synced < sequence) {
+            if (!writing) {
+                write_pending(guard, true);
+            } else {
+                written.wait(guard);
+            }
+        }
+    } else if (pending.size() >= WAL_BUFFER_ENTRIES) {
+        write_pending(guard, false);
+    }
+
+    return sequence;
+}
+
+void WriteAheadLog::sync_loop(void) {
+    unique_lock<mutex> guard(lock);
+
+    while (!stopping) {
+        written.wait_for(guard, chrono::milliseconds(interval_ms));
+        if (!stopping) write_pending(guard, true);
+    }
+}
+
+/*
+ * Finish the current segment and start a new one, returning its
+ * number.
+ */
+long WriteAheadLog::rotate(void) {
+    unique_lock<mutex> guard(lock);
+
+    write_pending(guard, policy != SYNC_NONE);
+
+    // Keep writers out while the file is switched
+    while (writing) {
+        written.wait(guard);
+    }
+
+    if (!open_segment(current_segment() + 1)) {
+        die("Could not open log segment '" + segment_path(current_segment() + 1) + "'.");
+    }
+
+    return current_segment();
+}
+
+/*
+ * Remove all segments before the given one
+ */
+void WriteAheadLog::truncate(long segment) {
+    lock_guard<mutex> guard(lock);
+
+    if (segments.empty() || *segments.begin() >= segment) return;
+
+    while (!segments.empty() && *segments.begin() < segment) {
+        unlink(segment_path(*segments.begin()).c_str());
+        segments.erase(segments.begin());
+    }
+
+    if (!sync_directory()) die("Could not sync log directory '" + directory + "'.");
+}
@@ -0,0 +1,71 @@
+#ifndef WAL_H
+#define WAL_H
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "status.h"
+#include "types.h"
+
+#define WAL_BUFFER_ENTRIES 512
+#define WAL_FILE_SUFFIX ".log"
+
+using namespace std;
+
+/*
+ * When appended entries reach the disk: after every append (with
+ * concurrent appends sharing one write and fdatasync), every so many
+ * milliseconds, or whenever the OS gets round to it.
+ */
+enum sync_policy {SYNC_ALWAYS, SYNC_INTERVAL, SYNC_NONE};
+
+typedef enum sync_policy sync_policy_t;
+
+struct wal_record {
+    entry_t entry;
+    uint32_t checksum;
+};
+
+typedef struct wal_record wal_record_t;
+
+/*
+ * Write-ahead log for the buffers. The log is a sequence of numbered
+ * segment files in a directory. The tree starts a new segment every
+ * time it swaps buffers, and removes old segments once all of their
+ * entries have been flushed to level 0.
+ */
+class WriteAheadLog {
+    string directory;
+    sync_policy_t policy;
+    int interval_ms;
+    set<long> segments;
+    int fd;
+    // Group commit state
+    mutex lock;
+    condition_variable written;
+    vector<wal_record_t> pending, batch;
+    long appended, synced;
+    bool writing, stopping;
+    thread sync_thread;
+    string segment_path(long) const;
+    bool open_segment(long);
+    bool sync_directory(void) const;
+    void write_pending(unique_lock<mutex>&, bool);
+    void sync_loop(void);
+public:
+    WriteAheadLog(string, sync_policy_t, int);
+    ~WriteAheadLog(void);
+    Status open(void);
+    Status replay(function<void(long, entry_t)>);
+    long append(entry_t);
+    long rotate(void);
+    long current_segment(void) const {return *segments.rbegin();}
+    void truncate(long);
+};
+
+#endif
@@ -1,21 +1,19 @@
-#include <cassert>
-
 #include "worker_pool.h"
 
-void WorkerPool::launch(worker_task& task) {
-    assert(futures.size() == 0);
+/*
+ * Run the task once on every worker and wait for all of them. The
+ * futures are kept locally, so several threads can share the pool.
+ */
+void WorkerPool::run(worker_task& task) {
+    vector<future<void>> futures;
 
     for (int i = 0; i < workers.size(); i++) {
         futures.push_back(enqueue(task));
     }
-}
 
-void WorkerPool::wait_all(void) {
     for (auto& future : futures) {
         future.wait();
     }
-
-    futures.clear();
 }
 
 void DynamicWorkerPool::launch(worker_task& task) {
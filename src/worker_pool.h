@@ -8,11 +8,10 @@ using namespace std;
 typedef function<void()> worker_task;
 
 class WorkerPool : ThreadPool {
-    vector<future<void>> futures;
 public:
     using ThreadPool::ThreadPool;
-    void launch(worker_task&);
-    void wait_all(void);
+    void run(worker_task&);
+    size_t size(void) const {return workers.size();}
 };
 
 class DynamicWorkerPool {